@@ -38,8 +38,28 @@
 #include <stdint.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fnmatch.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
 
-#define MAX_NUM_ARGUMENTS 4
+#include "fat32.h"
+
+#define MAX_NUM_ARGUMENTS 5
 
 #define WHITESPACE " \t\n"      // We want to split our command line up into tokens
                                 // so we need to define what delimits our tokens.
@@ -48,45 +68,388 @@
 
 #define MAX_COMMAND_SIZE 255    // The maximum command-line size
 
-struct __attribute__((__packed__)) DirectoryEntry
+#define FAT_CHUNK_ENTRIES 16384 // FAT entries df and fsck read from the image at a time
+
+#define EXTENT_CACHE_SIZE 64    // Number of file extent maps kept around once built
+
+#define COPY_BUFFER_SIZE (1024 * 1024) // Size of the aligned buffer get falls back to
+
+#define READAHEAD_DEPTH 16      // Reads get keeps in flight on a fragmented file
+#define READAHEAD_CHUNK (256 * 1024) // Largest single read get issues ahead
+#define READAHEAD_MIN_EXTENTS 4 // Files in fewer extents are left to copy_file_range()
+#define READAHEAD_THREADS 4     // Reading threads when io_uring is not available
+
+#define DIR_CACHE_SIZE 16       // Number of loaded directories kept in memory
+
+#define DENTRY_CACHE_SIZE 4096  // Number of resolved path components remembered by cd
+
+#define MAX_LONG_NAME 255       // Longest long name, in UCS-2 characters, put will store
+
+#define MAX_THREADS 16          // Upper bound on the worker threads of get -r and fsck
+
+#define TAR_BUFFER_SIZE (1024 * 1024) // Headers and small files export gathers per write
+
+#define TAR_SMALL_FILE (64 * 1024) // Files up to this size are read into the export buffer
+
+#define SUM_BUFFER_SIZE (1024 * 1024) // Bytes sum reads from the image at a time per thread
+
+#define READ_BUFFER_SIZE (1024 * 1024) // Bytes read takes from the image and prints at a time
+
+#define MAX_COMMAND_STATS 32    // Distinct command names stats keeps a row for
+
+#define MAX_TREE_DEPTH 128      // Directories nested deeper than this are not followed, which
+                                // also keeps a directory that contains itself from looping
+
+// A directory read into memory along with an index of its entries by name
+struct Directory
+{
+  uint32_t cluster;             // first cluster of the directory, 0 when the slot is unused
+  Fat32Dir *dir;                // the directory as the library read it, owns the two below
+  struct Fat32DirEntry *entries; // every entry of the directory, in on disk order
+  int count;                    // number of entries
+  char **longNames;             // UTF-8 long name of each entry, NULL if it has none
+  int *hash;                    // index into entries by 8.3 name, open addressing, -1 is empty
+  int *longHash;                // index into entries by case folded long name, same layout
+  int hashSize;                 // number of slots in each index, always a power of two
+  uint64_t lastUsed;            // tick of the last time the directory was used, for eviction
+};
+
+struct Directory dirCache[DIR_CACHE_SIZE];
+struct Directory *cwd = NULL;   // the current directory, always one of dirCache
+uint64_t dirTick = 0;           // incremented every time a directory is used
+
+// One resolved path component: the entry called name inside the directory at parent
+struct Dentry
+{
+  uint32_t parent;              // first cluster of the directory the name was looked up in
+  char *name;                   // the component, lower cased, NULL when the node is free
+  uint32_t cluster;             // first cluster the name resolved to
+  uint8_t attr;                 // attribute of the entry the name resolved to
+  int hashNext;                 // next node in the same bucket, -1 ends the chain
+  int prev;                     // neighbours in the LRU list, -1 at either end
+  int next;
+};
+
+struct Dentry dentryPool[DENTRY_CACHE_SIZE];
+int dentryBuckets[DENTRY_CACHE_SIZE * 2]; // heads of the hash chains, -1 when empty
+int dentryHead = -1;            // most recently used node
+int dentryTail = -1;            // least recently used node, evicted first
+int dentryUsed = 0;             // number of nodes handed out so far
+
+struct Fat32ExtentMap extentCache[EXTENT_CACHE_SIZE];
+
+// the checksum code sum runs, picked by hashInit() for the CPU at hand
+uint32_t (*crc32c)(uint32_t crc, const uint8_t *data, size_t len) = NULL;
+void (*sha256Blocks)(uint32_t *state, const uint8_t *data, size_t blocks) = NULL;
+
+// One file to be pulled out of the image by get -r, or a file or directory for export
+struct GetJob
+{
+  char *path;                   // where the file goes on the host, or its name in the archive
+  uint32_t size;                // size of the file in bytes
+  uint8_t attr;                 // attributes of the entry
+  time_t modified;              // last write time of the entry
+  struct Fat32ExtentMap map;    // private copy of the file's extents, the cache may evict its own
+};
+
+// A directory waiting to be walked by fsck or find
+struct DirJob
+{
+  uint32_t cluster;
+  char *path;
+};
+
+// State shared by the fsck threads
+struct Fsck
+{
+  uint64_t *owned;              // one bit per cluster, set once some chain has claimed it
+  struct DirJob *queue;        // directories still to be checked
+  int queued;
+  int queueCapacity;
+  int pending;                  // directories queued or being checked, 0 means all done
+  pthread_mutex_t lock;         // protects the queue, pending and problems
+  pthread_cond_t wake;
+  char **problems;              // everything found, sorted before printing
+  int problemCount;
+  int problemCapacity;
+  uint64_t files;
+  uint64_t dirs;
+  uint64_t clusters;            // clusters claimed by some chain
+};
+
+// One worker's share of the find queue. The owner pushes and pops at the tail while idle
+// workers steal from the head, where the oldest directories with the biggest subtrees wait
+struct FindDeque
+{
+  pthread_mutex_t lock;
+  struct DirJob *jobs;
+  int head;
+  int tail;
+  int capacity;
+};
+
+// State shared by the find threads
+struct Find
+{
+  const char *pattern;
+  struct FindDeque deques[MAX_THREADS];
+  int threads;
+  int pending;                  // directories queued or being searched, 0 means all done
+  uint64_t *visited;            // one bit per cluster, set once a directory starting there is queued
+  pthread_mutex_t lock;         // guards sleepers, taken before signalling wake
+  pthread_cond_t wake;          // signalled when directories are queued or pending drops to 0
+  int sleepers;                 // threads waiting on wake
+};
+
+// What each find thread gets handed, its deque is deques[id]
+struct FindWorker
+{
+  struct Find *find;
+  int id;
+};
+
+// One read of the get readahead pipeline
+struct ReadChunk
+{
+  off_t offset;                 // where the chunk starts in the image
+  uint32_t length;
+};
+
+// A file being copied out with reads running ahead of the writes. Chunk i is read into slot
+// i % READAHEAD_DEPTH, so at most READAHEAD_DEPTH chunks past the last written one are read
+struct Readahead
+{
+  struct ReadChunk *chunks;     // the file's extents cut into reads, in file order
+  int count;
+  uint8_t *buffers;             // READAHEAD_DEPTH buffers of READAHEAD_CHUNK bytes
+  int state[READAHEAD_DEPTH];   // per slot, 0 while reading, 1 once read, -1 if the read failed
+  int next;                     // next chunk to read
+  int written;                  // chunks written out so far
+  int failed;                   // set to stop the reading threads early
+  pthread_mutex_t lock;         // protects next, written, failed and state between threads
+  pthread_cond_t cond;
+};
+
+#ifdef HAVE_IO_URING
+// The parts of an io_uring get needs, mapped from the kernel
+struct Ring
+{
+  int fd;
+  uint32_t *sqHead;
+  uint32_t *sqTail;
+  uint32_t *sqMask;
+  uint32_t *sqArray;
+  struct io_uring_sqe *sqes;
+  uint32_t *cqHead;
+  uint32_t *cqTail;
+  uint32_t *cqMask;
+  struct io_uring_cqe *cqes;
+  void *sqRing;
+  size_t sqRingSize;
+  void *cqRing;
+  size_t cqRingSize;
+  size_t sqesSize;
+};
+#endif
+
+// Every file found under the directory given to get -r, shared by the copying threads
+struct GetJobList
+{
+  struct GetJob *jobs;
+  int count;
+  int capacity;
+  int next;                     // index of the next job to hand out, taken atomically
+  int archive;                  // 1 for export: directories become jobs, nothing is made on the host
+};
+
+// SHA-256 of a stream, blocks go to sha256Blocks as soon as 64 bytes are there
+struct Sha256
+{
+  uint32_t state[8];
+  uint8_t block[64];
+  size_t used;                  // bytes waiting in block
+  uint64_t length;              // bytes hashed so far
+};
+
+// Checksums of one file for sum
+struct SumResult
+{
+  const char *path;             // the job's path, owned by the job list
+  uint32_t crc;                 // CRC32C
+  uint8_t sha[32];              // SHA-256
+  int failed;                   // 1 if the file could not be read
+};
+
+// The files sum -r hashes, shared by its threads. results[i] belongs to list.jobs[i]
+struct SumJobs
+{
+  struct GetJobList list;
+  struct SumResult *results;
+};
+
+// What a command cost, or a snapshot of the counters it is worked out from
+struct CommandCost
 {
-  char DIR_Name[11];
-  uint8_t DIR_Attr;
-  uint8_t Unused1[8];
-  uint16_t DIR_FirstClusterHigh;
-  uint8_t Unused2[4];
-  uint16_t DIR_FirstClusterLow;
-  uint32_t DIR_FileSize;
+  double wall;                  // seconds
+  double cpu;                   // seconds of every thread of the process
+  struct Fat32IoStats io;
+  uint64_t hits;                // block cache hits and misses
+  uint64_t misses;
+  uint64_t image;               // which open image the snapshot was taken on, 0 for none
 };
 
-struct DirectoryEntry dir[16];
+// Everything one command name has cost since the counters were last reset
+struct CommandStats
+{
+  char name[16];
+  uint64_t runs;
+  struct CommandCost cost;
+};
+
+// The tar stream export writes, small pieces are gathered up into one large write
+struct TarWriter
+{
+  int fd;
+  uint8_t *buffer;              // TAR_BUFFER_SIZE bytes
+  size_t filled;
+  int failed;                   // set once a write failed, everything after is dropped
+};
 
 void sanitizeString(char * strPtr);
+int parseCommand(char *cmd_str, char **token);
+int runCommand(char **token);
+int dispatchCommand(char **token);
+void commandCost(struct CommandCost *cost);
+void costSince(struct CommandCost *cost, const struct CommandCost *before);
+void addCost(struct CommandCost *total, const struct CommandCost *cost);
+void traceCommand(char **token, const struct CommandCost *cost);
+void printStats(int reset);
+void closeImage();
+int runBatch(int argc, char *argv[]);
+int runBatchCommand(char *cmd_str);
+void printJson(const char *str, size_t len);
+char *nextToken(char **str);
 void show(char x);
 void printInfo();
-void populateInfo();
 void populateDirArr();
 void ls();
-int LBAToOffset(int32_t sector);
-int16_t NextLB(uint32_t sector);
-void stat(char *str);
+void fatStat(char *str);
 int findString(char * str);
 int cd(char *str);
-void cdMulti(char *str);
-void fatRead(char *name, char *pos, char *byt);
+void fatRead(char *name, char *pos, char *byt, int raw);
 void fatGet(char * str);
+void fatPut(char *path);
+void fatDel(char *name);
+int makeEntries(const char *name, struct Fat32DirEntry *entries, time_t modified);
+int shortNameTaken(struct Directory *d, const char *name);
+int findFreeSlots(struct Directory *d, int total, int count);
+void fatTimestamp(time_t when, uint8_t *date, uint8_t *time);
+int copyIntoExtents(struct Fat32ExtentMap *map, int64_t size, int inFd);
+void writeDone();
+int freeMapLoad();
+int allocClusters(uint32_t count, uint32_t *clusters);
+uint32_t nextFreeCluster(uint32_t from, uint32_t end);
+uint32_t nextUsedCluster(uint32_t from, uint32_t end);
+int fatFlush();
+void fatFind(char *pattern);
+void *findWorker(void *arg);
+void findSearchDir(struct Find *f, int id, struct DirJob *job);
+void findPush(struct FindDeque *q, struct DirJob *job);
+int findTake(struct Find *f, int id, struct DirJob *job);
+int findHasWork(struct Find *f);
+void findWake(struct Find *f);
+void prefetchDirs(struct DirJob *jobs, int count);
+int compareDirJobs(const void *a, const void *b);
+void fatFsck();
+void *fsckWorker(void *arg);
+void fsckCheckDir(struct Fsck *f, struct DirJob *job);
+int64_t fsckClaimChain(struct Fsck *f, uint32_t first, const char *path);
+int chainContains(uint32_t first, int64_t length, uint32_t cluster);
+void fsckProblem(struct Fsck *f, const char *format, ...);
+void fsckQueue(struct Fsck *f, uint32_t cluster, char *path);
+uint64_t fsckCompareFats(int copy);
+int compareStrings(const void *a, const void *b);
+void fatGetTree(char *src, char *dest);
+void fatExport(char *src, char *dest);
+int exportJob(struct TarWriter *w, struct GetJob *job);
+int tarHeader(struct TarWriter *w, const char *name, char type, uint32_t size, time_t modified,
+              int mode);
+void tarAppend(struct TarWriter *w, const void *data, size_t len);
+void tarPad(struct TarWriter *w, uint64_t size);
+void tarFlush(struct TarWriter *w);
+int readExtents(struct Fat32ExtentMap *map, int64_t size, uint8_t *dst);
+int copyFile(struct Fat32ExtentMap *map, int64_t size, int outFd);
+time_t fatTime(const uint8_t *date, const uint8_t *time);
+void fatSum(char *name, int recursive);
+void *sumWorker(void *arg);
+int sumFile(struct Fat32ExtentMap *map, int64_t size, uint8_t *buffer, struct SumResult *result);
+void printSum(struct SumResult *result);
+int compareSums(const void *a, const void *b);
+void hashInit();
+uint32_t crc32cScalar(uint32_t crc, const uint8_t *data, size_t len);
+void sha256Init(struct Sha256 *h);
+void sha256Update(struct Sha256 *h, const uint8_t *data, size_t len);
+void sha256Final(struct Sha256 *h, uint8_t *digest);
+void sha256BlocksScalar(uint32_t *state, const uint8_t *data, size_t blocks);
+int collectTree(struct GetJobList *list, uint32_t cluster, const char *hostDir, int depth);
+void *getWorker(void *arg);
+int compareJobs(const void *a, const void *b);
+const char *hostName(struct Directory *d, int index, char *buffer);
+void dirRelease(struct Directory *d);
+void fatDf(int quick);
+void fatCacheStats(int reset);
+void fatCacheSize(char *size);
+int countFat(uint32_t first, uint32_t count, uint64_t *counts);
+void countFatScalar(const uint32_t *fat, uint32_t count, uint64_t *counts);
+void fatFree();
+struct Fat32ExtentMap *getExtents(uint32_t firstCluster);
+void extentCacheFree();
+int copyExtents(struct Fat32ExtentMap *map, int64_t size, int outFd);
+int copyReadahead(struct Fat32ExtentMap *map, int64_t size, int outFd);
+int readaheadThreads(struct Readahead *r, int outFd);
+void *readaheadWorker(void *arg);
+int readaheadFlush(struct Readahead *r, int first, int last, int outFd);
+#ifdef HAVE_IO_URING
+int readaheadUring(struct Readahead *r, int outFd);
+int ringSetup(struct Ring *ring, unsigned entries);
+void ringClose(struct Ring *ring);
+#endif
+int writeAll(int fd, const void *buf, size_t len);
+struct Directory *getDirectory(uint32_t cluster);
+int loadDirectory(struct Directory *d, uint32_t cluster);
+void dirCacheFree();
+int findEntry(struct Directory *d, const char *str);
+int resolvePath(const char *path, uint32_t *cluster);
+int lookupComponent(uint32_t parent, const char *name, uint32_t *cluster, uint8_t *attr);
+int dentryFind(uint32_t parent, const char *name);
+void dentryInsert(uint32_t parent, const char *name, uint32_t cluster, uint8_t attr);
+void dentryTouch(int node);
+void dentryClear();
+uint32_t dentryHash(uint32_t parent, const char *name);
+uint32_t hashName(const char *name);
+uint32_t hashLongName(const char *name);
+const char *displayName(struct Directory *d, int index, char *buffer);
 
-FILE *filePtr = NULL;
-int16_t BPB_BytsPerSec;
-int8_t BPB_SecPerClus;
-int16_t BPB_RsvdSecCnt;
-int8_t BPB_NumFATs;
-int32_t BPB_FATSz32;
-void cdMulti(char *str);
+Fat32Volume *volume = NULL;     // the open image, NULL when nothing is open
+const struct Fat32Info *info = NULL; // its geometry, valid while volume is open
+uint64_t *freeMap = NULL;       // one bit per cluster, set while the cluster is free
+uint32_t freeClusters = 0;      // number of bits set in freeMap
+uint32_t nextFreeHint = 2;      // where the allocator starts looking, seeded from FSInfo
+int captureFd = -1;             // memory file batch mode points stdout at while a command runs
+uint64_t imageCount = 0;        // images opened so far, tells counters of one image from the next
+struct CommandStats commandStats[MAX_COMMAND_STATS];
+int commandStatsCount = 0;
+int traceCommands = 0;          // 1 to print what every command cost to stderr
 
 
-int main()
+int main(int argc, char *argv[])
 {
+  // MFS_TRACE in the environment starts mfs with trace on
+  traceCommands = getenv("MFS_TRACE") != NULL;
+  // any arguments mean batch mode, the interactive prompt is never shown
+  if(argc > 1)
+    return runBatch(argc, argv);
+
   char * cmd_str = (char *)malloc(MAX_COMMAND_SIZE);  // pointer used to keep the input from the user
   int control = 1;
   while(control)
@@ -112,399 +475,3653 @@ int main()
     if(strlen(cmd_str) < 2)
       continue;
     
-    /* Parse input */
-    char *token[MAX_NUM_ARGUMENTS];
-    
-    int token_count = 0;
-    
-    // Pointer to point to the token
-    // parsed by strsep
-    char *argument_ptr;
-    
-    char *working_str = strdup( cmd_str );
-    
-    // we are going to move the working_str pointer so
-    // keep track of its original value so we can deallocate
-    // the correct amount at the end
-    char *working_root = working_str;
-    
-    // Tokenize the input strings with whitespace used as the delimiter
-    while ((token_count < MAX_NUM_ARGUMENTS) &&
-           ((argument_ptr = strsep(&working_str, WHITESPACE )) != NULL))
-    {
-      token[token_count] = strndup( argument_ptr, MAX_COMMAND_SIZE );
-      if(strlen( token[token_count] ) == 0)
-      {
-        free(token[token_count]);
-        token[token_count] = NULL;
-      }
-      token_count++;
-    }
-    
+    char *token[MAX_NUM_ARGUMENTS] = { NULL };
+    int token_count = parseCommand(cmd_str, token);
     
     //if there are any tokenized inputs proceed
-    if(token_count)
-    {
-      // if the input is quit or stop exit out of the loop after deallocating the dynamic memory
-      if((strcmp(token[0],
-                 "exit") == 0 ||
-          strcmp(token[0], "quit") == 0 || strcmp(token[0], "stop") == 0) && token[1] == NULL)
-      {
-        control = 0;
-      }
-      
-      if(strcmp(token[0], "open") == 0)
-      {
-        if(filePtr != NULL)
-          printf("Error: File system image already open.\n");
-        else
-        {
-          filePtr = fopen(token[1], "r");
-          if(filePtr == NULL)
-            printf("Error: File system image not found.\n");
-          else
-          {
-            populateInfo();
-            populateDirArr();
-          }
-        }
-      }
-      if(strcmp(token[0], "info") == 0)
-      {
-        if (filePtr == NULL)
-        {
-          printf("Error: File system not open.\n");
-        }
-        else printInfo();
-      }
-      if(strcmp(token[0], "ls") == 0)
-      {
-        if (filePtr == NULL)
-        {
-          printf("Error: File system not open.\n");
-        }
-        else ls();
-      }
-      if(strcmp(token[0], "close") == 0)
-      {
-        if (filePtr == NULL)
-        {
-          printf("Error: File system not open.\n");
-        }
-        else
-        {
-          fclose(filePtr);
-          filePtr = NULL;
-        }
-      }
-      if(strcmp(token[0], "stat") == 0)
-      {
-        if (filePtr == NULL)
-        {
-          printf("Error: File system not open.\n");
-        }
-        else stat(token[1]);
-      }
-      if(strcmp(token[0], "cd") == 0)
-      {
-        if (filePtr == NULL)
-        {
-          printf("Error: File system not open.\n");
-        }
-        else cd(token[1]);
-      }
-      if(strcmp(token[0], "read") == 0)
-      {
-        if (filePtr == NULL)
-        {
-          printf("Error: File system not open.\n");
-        }
-        else fatRead(token[1], token[2], token[3]);
-      }
-      if(strcmp(token[0], "get") == 0)
-      {
-        if (filePtr == NULL)
-        {
-          printf("Error: File system not open.\n");
-        }
-        else fatGet(token[1]);
-      }
-    }
-    
-    
+    if(token_count && token[0] != NULL)
+      control = runCommand(token);
     
     //from this point on, all that happens is the deallocation of all dynamic memory
     for(int token_index = 0; token_index < token_count; token_index++)
     {
       free(token[token_index]);
     }
-    free( working_root );
     
   }
   free(cmd_str);
-  if(filePtr != NULL)
-  {
-    fseek(filePtr, 0, SEEK_SET);
-    fclose(filePtr);
-  }
+  closeImage();
   return 0;
 }
 
-void stat(char *str)
+/*
+ * parameters  : A sanitized command line and an array of MAX_NUM_ARGUMENTS NULL pointers
+ * returns     : The number of tokens, each of which has to be freed by the caller
+ * description : Splits the command line up on white space. Empty tokens are left as NULL.
+ */
+int parseCommand(char *cmd_str, char **token)
 {
-  int i = findString(str);
-  if(i == -1)
+  /* Parse input */
+  int token_count = 0;
+  
+  // Pointer to point to the token
+  // parsed by nextToken
+  char *argument_ptr;
+  
+  char *working_str = strdup( cmd_str );
+  
+  // we are going to move the working_str pointer so
+  // keep track of its original value so we can deallocate
+  // the correct amount at the end
+  char *working_root = working_str;
+  
+  // Tokenize the input strings with whitespace used as the delimiter
+  while ((token_count < MAX_NUM_ARGUMENTS) &&
+         ((argument_ptr = nextToken(&working_str)) != NULL))
   {
-    printf("Error: File not found.\n");
-    return;
+    token[token_count] = strndup( argument_ptr, MAX_COMMAND_SIZE );
+    if(strlen( token[token_count] ) == 0)
+    {
+      free(token[token_count]);
+      token[token_count] = NULL;
+    }
+    token_count++;
   }
-  printf("Attribute: \t 0x%x\n", dir[i].DIR_Attr);
-  printf("Cluster number:\t %d\n", dir[i].DIR_FirstClusterLow);
-  if(dir[i].DIR_Attr == 0x10)
-    printf("Size: \t\t 0\n");
-  else
-    printf("Size: \t\t %d\n", dir[i].DIR_FileSize);
+  free( working_root );
+  return token_count;
 }
 
-void ls()
+/*
+ * parameters  : The tokens of one command, token[0] is never NULL
+ * returns     : 0 if the command asks to quit, 1 otherwise
+ * description : Runs one command with dispatchCommand() and charges its wall time, CPU time,
+ *              I/O, cache hits and FAT lookups to the row of its name in the statistics. With
+ *              trace on the cost is also printed to stderr, which keeps it out of the output
+ *              batch mode captures.
+ */
+int runCommand(char **token)
 {
-  for(int i = 0; i < 16; i++)
+  struct CommandCost before;
+  struct CommandCost cost;
+  commandCost(&before);
+  int control = dispatchCommand(token);
+  commandCost(&cost);
+  costSince(&cost, &before);
+
+  int row = 0;
+  while(row < commandStatsCount && strncmp(commandStats[row].name, token[0], 15) != 0)
+    row++;
+  if(row == commandStatsCount && row < MAX_COMMAND_STATS)
   {
-    char filename[12];
-    strncpy(filename, &dir[i].DIR_Name[0], 11);
-    filename[11] = '\0';
-    if(dir[i].DIR_Attr == 0x01 || dir[i].DIR_Attr == 0x10 || dir[i].DIR_Attr == 0x20)
-      printf("%s\n", filename);
+    memset(&commandStats[row], 0, sizeof(struct CommandStats));
+    strncpy(commandStats[row].name, token[0], 15);
+    commandStatsCount++;
   }
+  // once the table is full new names are charged to its last row
+  if(row == MAX_COMMAND_STATS)
+    row--;
+  commandStats[row].runs++;
+  addCost(&commandStats[row].cost, &cost);
+  if(traceCommands)
+    traceCommand(token, &cost);
+  return control;
 }
 
-int findString(char * str)
+/*
+ * parameters  : The tokens of one command, token[0] is never NULL
+ * returns     : 0 if the command asks to quit, 1 otherwise
+ * description : Runs one command. Everything it has to say goes to stdout, problems as lines
+ *              starting with "Error:".
+ */
+int dispatchCommand(char **token)
 {
-  if(strlen(str) > 11 || strlen(str) < 1)
-    return -1;
-  for(int i = 0; i < 16; i++)
+  // if the input is quit or stop exit out of the loop after deallocating the dynamic memory
+  if((strcmp(token[0],
+             "exit") == 0 ||
+      strcmp(token[0], "quit") == 0 || strcmp(token[0], "stop") == 0) && token[1] == NULL)
+  {
+    return 0;
+  }
+  
+  if(strcmp(token[0], "open") == 0)
   {
-    if(dir[i].DIR_Attr == 0x01 || dir[i].DIR_Attr == 0x10 || dir[i].DIR_Attr == 0x20)
+    if(volume != NULL)
+      printf("Error: File system image already open.\n");
+    else
     {
-      char filename[12];
-      strncpy(filename, &dir[i].DIR_Name[0], 11);
-      filename[11] = '\0';
-      char normalized[12];
-      normalized[11] = '\0';
-      memset(&normalized, ' ', 11);
-      if(strcmp(str, "..") == 0)
+      // put and del need a writable image, everything else is happy with a read only one
+      errno = 0;
+      if(token[1] == NULL || (volume = fat32Open(token[1], 1)) == NULL)
       {
-        normalized[0] = '.';
-        normalized[1] = '.';
+        if(errno == EINVAL)
+          printf("Error: %s is not a FAT32 file system image.\n", token[1]);
+        else printf("Error: File system image not found.\n");
       }
       else
       {
-        if(dir[i].DIR_Attr == 0x20)
-        {
-          for(int i = strlen(str) - 1; i >= 0; i--)
-          {
-            if(*(str + i) == '.')
-              break;
-            normalized[11 - (strlen(str) - i)] = toupper(*(str + i));
-          }
-        }
-        for(int i = 0; i < strlen(str); i++)
-        {
-          if(*(str + i) == '.')
-            break;
-          normalized[i] = toupper(*(str + i));
-        }
-      }
-      if(strcmp(filename, normalized) == 0)
-      {
-        return i;
+        info = fat32GetInfo(volume);
+        imageCount++;
+        populateDirArr();
       }
     }
   }
-  return -1;
-}
-
-void populateDirArr()
-{
-  fseek(filePtr,
-        ((BPB_NumFATs * BPB_FATSz32 * BPB_BytsPerSec) + (BPB_RsvdSecCnt * BPB_BytsPerSec)),
-        SEEK_SET);
-  fread(&dir, sizeof(struct DirectoryEntry), 16, filePtr);
-  fseek(filePtr, 0, SEEK_SET);
-}
-
-
-void fatGet(char * str)
-{
-  int index = findString(str);
-  if(index == -1)
+  if(strcmp(token[0], "info") == 0)
   {
-    printf("Error: File not found.\n");
-    return;
+    if (volume == NULL)
+    {
+      printf("Error: File system not open.\n");
+    }
+    else printInfo();
   }
-  FILE * outputFile = fopen(str, "w");
-  unsigned char buffer[512];
-  
-  int cluster = dir[index].DIR_FirstClusterLow;
-  int offset = LBAToOffset(cluster);
-  int c = dir[index].DIR_FileSize;
-  while(cluster != -1)
-  {
-    offset = LBAToOffset(cluster);
-    fseek(filePtr, offset, SEEK_SET);
-    if(c < 512)
-    {
-      fread(&buffer[0], c, 1, filePtr);
-      fwrite(&buffer[0], c, 1, outputFile);
-      fclose(outputFile);
-      return;
+  if(strcmp(token[0], "ls") == 0)
+  {
+    if (volume == NULL)
+    {
+      printf("Error: File system not open.\n");
     }
-    else
+    else ls();
+  }
+  if(strcmp(token[0], "close") == 0)
+  {
+    if (volume == NULL)
     {
-      fread(&buffer[0], 512, 1, filePtr);
-      fwrite(&buffer[0], 512, 1, outputFile);
-      cluster = NextLB(cluster);
-      c -= 512;
+      printf("Error: File system not open.\n");
     }
+    else closeImage();
   }
-  fclose(outputFile);
-}
-
-void fatRead(char *name, char *pos, char *byt)
-{
-  int index = findString(name);
-  int position = atoi(pos);
-  int bytes = atoi(byt);
-  int cluster = dir[index].DIR_FirstClusterLow;
-  int offset = LBAToOffset(cluster);
-  fseek(filePtr, offset + position, SEEK_SET);
-  int8_t temp;
-  for(int i = 0; i < bytes; i++)
+  if(strcmp(token[0], "stat") == 0)
   {
-    fread(&temp, sizeof(char), 1, filePtr);
-    printf("%x ", temp);
+    if (volume == NULL)
+    {
+      printf("Error: File system not open.\n");
+    }
+    else fatStat(token[1]);
   }
-  printf("\n");
-}
-
-int cd(char *str)
-{
-  if(strstr(str, "/") == NULL)
+  if(strcmp(token[0], "cd") == 0)
   {
-    int index = findString(str);
-    if(index == -1)
+    if (volume == NULL)
     {
-      printf("Error: Subdirectory not found.\n");
-      return -1;
+      printf("Error: File system not open.\n");
+    }
+    else cd(token[1]);
+  }
+  if(strcmp(token[0], "read") == 0)
+  {
+    if (volume == NULL)
+    {
+      printf("Error: File system not open.\n");
     }
-    if(dir[index].DIR_Attr != 0x10)
+    // "read -b" writes the raw bytes to stdout instead of a hex dump
+    else if(token[1] != NULL && strcmp(token[1], "-b") == 0)
+      fatRead(token[2], token[3], token[4], 1);
+    else fatRead(token[1], token[2], token[3], 0);
+  }
+  if(strcmp(token[0], "get") == 0)
+  {
+    if (volume == NULL)
     {
-      printf("Error: Subdirectory not found.\n");
-      return -1;
+      printf("Error: File system not open.\n");
     }
-    int cluster = dir[index].DIR_FirstClusterLow;
-    int offset = LBAToOffset(cluster);
-    fseek(filePtr, offset, SEEK_SET);
-    fread(&dir, sizeof(struct DirectoryEntry), 16, filePtr);
+    else if(token[1] != NULL && strcmp(token[1], "-r") == 0)
+      fatGetTree(token[2], token[3]);
+    else fatGet(token[1]);
   }
-  else
+  if(strcmp(token[0], "sum") == 0)
   {
-    cdMulti(str);
+    if (volume == NULL)
+    {
+      printf("Error: File system not open.\n");
+    }
+    else if(token[1] != NULL && strcmp(token[1], "-r") == 0)
+      fatSum(token[2], 1);
+    else fatSum(token[1], 0);
   }
-  return 0;
-}
-
-void cdMulti(char *str)
-{
-  int size = 0;
-  int cds = 0;
-  for(int i = 0; i <= strlen(str); i++)
+  if(strcmp(token[0], "export") == 0)
   {
-    if(*(str + i) == '/' || i == strlen(str))
+    if (volume == NULL)
     {
-      char *temp = (char *)malloc((sizeof(char) * size) + 1);
-      for(int j = 0; j < size; j++)
-      {
-        *(temp + j) = *(str - size + j + i);
-      }
-      *(temp + size) = '\0';
-      size = 0;
-      if(cd(temp) == -1)
-      {
-        for(int j = 0; j < cds; j++)
-        {
-          char *temp2 = (char *)malloc(sizeof(char) * 3);
-          *(temp2) = '.';
-          *(temp2 + 1) = '.';
-          *(temp2 + 2) = '\0';
-          cd(temp2);
-          free(temp2);
-        }
-        free(temp);
-        return;
-      }
-      free(temp);
-      cds++;
+      printf("Error: File system not open.\n");
+    }
+    else fatExport(token[1], token[2]);
+  }
+  if(strcmp(token[0], "put") == 0)
+  {
+    if (volume == NULL)
+    {
+      printf("Error: File system not open.\n");
+    }
+    else fatPut(token[1]);
+  }
+  if(strcmp(token[0], "del") == 0)
+  {
+    if (volume == NULL)
+    {
+      printf("Error: File system not open.\n");
+    }
+    else fatDel(token[1]);
+  }
+  if(strcmp(token[0], "find") == 0)
+  {
+    if (volume == NULL)
+    {
+      printf("Error: File system not open.\n");
     }
-    else size++;
+    else if(token[1] == NULL)
+      printf("Error: Usage is find <pattern>.\n");
+    else fatFind(token[1]);
   }
+  if(strcmp(token[0], "fsck") == 0)
+  {
+    if (volume == NULL)
+    {
+      printf("Error: File system not open.\n");
+    }
+    else fatFsck();
+  }
+  if(strcmp(token[0], "df") == 0)
+  {
+    if (volume == NULL)
+    {
+      printf("Error: File system not open.\n");
+    }
+    // "df -q" trusts the FSInfo free count instead of scanning when the count is valid
+    else fatDf(token[1] != NULL && strcmp(token[1], "-q") == 0);
+  }
+  if(strcmp(token[0], "cachestats") == 0)
+  {
+    if (volume == NULL)
+    {
+      printf("Error: File system not open.\n");
+    }
+    // "cachestats -r" starts the counters over once they are printed
+    else fatCacheStats(token[1] != NULL && strcmp(token[1], "-r") == 0);
+  }
+  if(strcmp(token[0], "cachesize") == 0)
+  {
+    if (volume == NULL)
+    {
+      printf("Error: File system not open.\n");
+    }
+    else fatCacheSize(token[1]);
+  }
+  if(strcmp(token[0], "stats") == 0)
+  {
+    // "stats -r" starts the counters over once they are printed
+    printStats(token[1] != NULL && strcmp(token[1], "-r") == 0);
+  }
+  if(strcmp(token[0], "trace") == 0)
+  {
+    if(token[1] != NULL && strcmp(token[1], "on") == 0)
+      traceCommands = 1;
+    else if(token[1] != NULL && strcmp(token[1], "off") == 0)
+      traceCommands = 0;
+    else
+      printf("Error: Usage is trace on|off.\n");
+  }
+  return 1;
 }
 
-/*
- * parameters  : The current sector number that points to a block of data
- * returns     : The value of the address for that block of data
- * description : Finds the starting address of a block of data given the sector number
- *              corresponding to that data block.
- */
-int LBAToOffset(int32_t sector)
+// takes a snapshot of the clocks and of the counters of the open image
+void commandCost(struct CommandCost *cost)
 {
-  if(sector == 0)
-    sector = 2;
-  return ((sector - 2) * BPB_BytsPerSec) + (BPB_BytsPerSec * BPB_RsvdSecCnt) +
-         (BPB_NumFATs * BPB_FATSz32 * BPB_BytsPerSec);
+  struct timespec ts;
+  memset(cost, 0, sizeof(struct CommandCost));
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  cost->wall = ts.tv_sec + ts.tv_nsec / 1e9;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  cost->cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+  if(volume == NULL)
+    return;
+  struct Fat32CacheStats cache;
+  fat32GetIoStats(volume, &cost->io);
+  fat32GetCacheStats(volume, &cache);
+  cost->hits = cache.hits;
+  cost->misses = cache.misses;
+  cost->image = imageCount;
 }
 
-/*
- * purpose : given a logical block address, look up into the first FAT and
- * return the logical block address of the block in the file.
- * if there is no further blocks then return -1
- */
-int16_t NextLB(uint32_t sector)
+// turns the snapshot in cost into what happened since before. counters of an image that was
+// opened in between count from zero, and counters that went down (cachestats -r) count as zero
+void costSince(struct CommandCost *cost, const struct CommandCost *before)
 {
-  uint32_t FATAddress = (BPB_BytsPerSec * BPB_RsvdSecCnt) + (sector * 4);
-  int16_t val;
-  fseek(filePtr, FATAddress, SEEK_SET);
-  fread(&val, 2, 1, filePtr);
-  return val;
+  struct CommandCost zero;
+  memset(&zero, 0, sizeof(zero));
+  cost->wall -= before->wall;
+  cost->cpu -= before->cpu;
+  if(cost->image != before->image)
+    before = &zero;
+  uint64_t *now[] = { &cost->io.reads, &cost->io.bytesRead, &cost->io.seeks, &cost->io.writes,
+                      &cost->io.bytesWritten, &cost->io.fatLookups, &cost->hits, &cost->misses };
+  const uint64_t then[] = { before->io.reads, before->io.bytesRead, before->io.seeks,
+                            before->io.writes, before->io.bytesWritten, before->io.fatLookups,
+                            before->hits, before->misses };
+  for(int i = 0; i < 8; i++)
+    *now[i] = *now[i] > then[i] ? *now[i] - then[i] : 0;
 }
 
-void populateInfo()
+void addCost(struct CommandCost *total, const struct CommandCost *cost)
 {
-  fseek(filePtr, 11, SEEK_SET);
-  fread(&BPB_BytsPerSec, 2, 1, filePtr);
-  fseek(filePtr, 13, SEEK_SET);
-  fread(&BPB_SecPerClus, 1, 1, filePtr);
-  fseek(filePtr, 14, SEEK_SET);
-  fread(&BPB_RsvdSecCnt, 2, 1, filePtr);
-  fseek(filePtr, 16, SEEK_SET);
-  fread(&BPB_NumFATs, 1, 1, filePtr);
-  fseek(filePtr, 36, SEEK_SET);
-  fread(&BPB_FATSz32, 4, 1, filePtr);
-  fseek(filePtr, 0, SEEK_SET);
+  total->wall += cost->wall;
+  total->cpu += cost->cpu;
+  total->io.reads += cost->io.reads;
+  total->io.bytesRead += cost->io.bytesRead;
+  total->io.seeks += cost->io.seeks;
+  total->io.writes += cost->io.writes;
+  total->io.bytesWritten += cost->io.bytesWritten;
+  total->io.fatLookups += cost->io.fatLookups;
+  total->hits += cost->hits;
+  total->misses += cost->misses;
 }
 
-void printInfo()
+// prints one trace line for a command to stderr
+void traceCommand(char **token, const struct CommandCost *cost)
 {
-  printf("BPB_BytsPerSec:\t %d\t 0x%x\n", BPB_BytsPerSec, BPB_BytsPerSec);
-  printf("BPB_SecPerClus:\t %d\t 0x%x\n", BPB_SecPerClus, BPB_SecPerClus);
-  printf("BPB_RsvdSecCnt:\t %d\t 0x%x\n", BPB_RsvdSecCnt, BPB_RsvdSecCnt);
-  printf("BPB_NumFATs:\t %d\t 0x%x\n", BPB_NumFATs, BPB_NumFATs);
-  printf("BPB_FATSz32:\t %d\t 0x%x\n", BPB_FATSz32, BPB_FATSz32);
+  fprintf(stderr, "trace:");
+  for(int i = 0; i < MAX_NUM_ARGUMENTS && token[i] != NULL; i++)
+    fprintf(stderr, " %s", token[i]);
+  fprintf(stderr, ": %.3f ms wall, %.3f ms cpu, %llu reads (%llu bytes, %llu seeks), "
+          "%llu writes (%llu bytes), %llu hits, %llu misses, %llu FAT lookups\n",
+          cost->wall * 1000, cost->cpu * 1000, (unsigned long long)cost->io.reads,
+          (unsigned long long)cost->io.bytesRead, (unsigned long long)cost->io.seeks,
+          (unsigned long long)cost->io.writes, (unsigned long long)cost->io.bytesWritten,
+          (unsigned long long)cost->hits, (unsigned long long)cost->misses,
+          (unsigned long long)cost->io.fatLookups);
 }
 
-// accepts a char pointer and will get rid of any leading white spoce by shifting the whole string
-// in place. no return type as everything is done on the same pointer.
-void sanitizeString(char * strPtr)
+/*
+ * parameters  : 1 to zero the counters once they are printed
+ * description : Prints what every command name has cost since mfs started, or since the last
+ *              reset, one row per name and the sum of them all at the bottom. The time is in
+ *              milliseconds, CPU time counts every thread so it can exceed the wall time.
+ */
+void printStats(int reset)
+{
+  struct CommandStats total;
+  memset(&total, 0, sizeof(total));
+  strcpy(total.name, "total");
+  printf("%-12s %6s %10s %10s %8s %12s %7s %7s %13s %8s %8s %11s\n", "command", "runs",
+         "wall ms", "cpu ms", "reads", "bytes read", "seeks", "writes", "bytes written", "hits",
+         "misses", "FAT lookups");
+  for(int i = 0; i <= commandStatsCount; i++)
+  {
+    struct CommandStats *row = i < commandStatsCount ? &commandStats[i] : &total;
+    if(i < commandStatsCount)
+    {
+      total.runs += row->runs;
+      addCost(&total.cost, &row->cost);
+    }
+    printf("%-12s %6llu %10.3f %10.3f %8llu %12llu %7llu %7llu %13llu %8llu %8llu %11llu\n",
+           row->name, (unsigned long long)row->runs, row->cost.wall * 1000,
+           row->cost.cpu * 1000, (unsigned long long)row->cost.io.reads,
+           (unsigned long long)row->cost.io.bytesRead, (unsigned long long)row->cost.io.seeks,
+           (unsigned long long)row->cost.io.writes,
+           (unsigned long long)row->cost.io.bytesWritten, (unsigned long long)row->cost.hits,
+           (unsigned long long)row->cost.misses, (unsigned long long)row->cost.io.fatLookups);
+  }
+  if(reset)
+    commandStatsCount = 0;
+}
+
+// releases everything that belongs to the open image, if there is one
+void closeImage()
+{
+  if(volume == NULL)
+    return;
+  dirCacheFree();
+  dentryClear();
+  extentCacheFree();
+  fatFree();
+  fat32Close(volume);
+  volume = NULL;
+  info = NULL;
+}
+
+/*
+ * parameters  : The program's arguments
+ * returns     : 0 if every command ran, 1 on bad usage
+ * description : Batch mode, "mfs [-i image] [-f commandfile] [-c command]...". The options run
+ *              in the order they are given: -i opens an image, -f runs every line of a file
+ *              ("-" for stdin, lines starting with # are skipped) and -c runs one command. The
+ *              image and its caches stay open from one command to the next. Every command
+ *              prints a single JSON line holding the command, "ok" or "error" and its output.
+ */
+int runBatch(int argc, char *argv[])
+{
+  char *cmd_str = (char *)malloc(MAX_COMMAND_SIZE);
+  int control = 1;
+  for(int i = 1; i < argc && control; i++)
+  {
+    if(i + 1 >= argc || (strcmp(argv[i], "-i") != 0 && strcmp(argv[i], "-f") != 0 &&
+                         strcmp(argv[i], "-c") != 0))
+    {
+      fprintf(stderr, "Usage: %s [-i image] [-f commandfile] [-c command]...\n", argv[0]);
+      free(cmd_str);
+      closeImage();
+      return 1;
+    }
+    char *arg = argv[++i];
+    if(strcmp(argv[i - 1], "-f") == 0)
+    {
+      FILE *file = strcmp(arg, "-") == 0 ? stdin : fopen(arg, "r");
+      if(file == NULL)
+      {
+        fprintf(stderr, "%s: could not open %s\n", argv[0], arg);
+        continue;
+      }
+      while(control && fgets(cmd_str, MAX_COMMAND_SIZE, file) != NULL)
+      {
+        if(cmd_str[0] != '#')
+          control = runBatchCommand(cmd_str);
+      }
+      if(file != stdin)
+        fclose(file);
+      continue;
+    }
+    // -i and -c are turned into a command line as if it had been typed
+    snprintf(cmd_str, MAX_COMMAND_SIZE, "%s%s\n", argv[i - 1][1] == 'i' ? "open " : "", arg);
+    control = runBatchCommand(cmd_str);
+  }
+  free(cmd_str);
+  closeImage();
+  return 0;
+}
+
+/*
+ * parameters  : A command line in a buffer of MAX_COMMAND_SIZE bytes
+ * returns     : What runCommand() returned, 1 for blank lines
+ * description : Runs a command with stdout pointed at a memory file and prints what it wrote
+ *              as {"command": ..., "status": ..., "output": ...}.
+ */
+int runBatchCommand(char *cmd_str)
+{
+  sanitizeString(cmd_str);
+  cmd_str[strcspn(cmd_str, "\n")] = '\0';
+  if(cmd_str[0] == '\0')
+    return 1;
+  char line[MAX_COMMAND_SIZE + 1];
+  snprintf(line, sizeof(line), "%s\n", cmd_str);
+
+  char *token[MAX_NUM_ARGUMENTS] = { NULL };
+  int token_count = parseCommand(line, token);
+  if(token_count == 0 || token[0] == NULL)
+  {
+    for(int i = 0; i < token_count; i++)
+      free(token[i]);
+    return 1;
+  }
+
+  // the memory file is made once and truncated between commands
+  if(captureFd == -1)
+    captureFd = memfd_create("mfs-output", 0);
+  if(captureFd == -1)
+  {
+    FILE *tmp = tmpfile();
+    if(tmp != NULL)
+    {
+      captureFd = dup(fileno(tmp));
+      fclose(tmp);
+    }
+  }
+  // the output has to stay one record per line, so without a place to capture it the command
+  // is not run at all
+  if(captureFd == -1)
+  {
+    const char *error = "Error: Could not capture the output of the command.\n";
+    printf("{\"command\": ");
+    printJson(cmd_str, strlen(cmd_str));
+    printf(", \"status\": \"error\", \"output\": ");
+    printJson(error, strlen(error));
+    printf("}\n");
+    fflush(stdout);
+    for(int i = 0; i < token_count; i++)
+      free(token[i]);
+    return 1;
+  }
+  fflush(stdout);
+  int savedFd = dup(STDOUT_FILENO);
+  dup2(captureFd, STDOUT_FILENO);
+  int control = runCommand(token);
+  fflush(stdout);
+  dup2(savedFd, STDOUT_FILENO);
+  close(savedFd);
+  for(int i = 0; i < token_count; i++)
+    free(token[i]);
+
+  off_t length = lseek(captureFd, 0, SEEK_CUR);
+  char *output = (char *)malloc(length + 1);
+  length = pread(captureFd, output, length, 0);
+  output[length < 0 ? 0 : length] = '\0';
+  ftruncate(captureFd, 0);
+  lseek(captureFd, 0, SEEK_SET);
+
+  int failed = strncmp(output, "Error:", 6) == 0 || strstr(output, "\nError:") != NULL;
+  printf("{\"command\": ");
+  printJson(cmd_str, strlen(cmd_str));
+  printf(", \"status\": \"%s\", \"output\": ", failed ? "error" : "ok");
+  printJson(output, length < 0 ? 0 : length);
+  printf("}\n");
+  fflush(stdout);
+  free(output);
+  return control;
+}
+
+// prints len bytes of str as a quoted JSON string. valid UTF-8 is kept as it is, anything else
+// (raw bytes from read -b for instance) is written as \u00XX
+void printJson(const char *str, size_t len)
+{
+  const uint8_t *p = (const uint8_t *)str;
+  putchar('"');
+  for(size_t i = 0; i < len; i++)
+  {
+    uint8_t c = p[i];
+    int follow = c >= 0xF0 && c < 0xF8 ? 3 : c >= 0xE0 ? 2 : c >= 0xC2 ? 1 : 0;
+    if(c >= 0x80 && follow > 0 && i + follow < len)
+    {
+      int valid = 1;
+      for(int j = 1; j <= follow; j++)
+        valid &= (p[i + j] & 0xC0) == 0x80;
+      if(valid)
+      {
+        fwrite(p + i, 1, follow + 1, stdout);
+        i += follow;
+        continue;
+      }
+    }
+    if(c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if(c == '\n')
+      printf("\\n");
+    else if(c == '\t')
+      printf("\\t");
+    else if(c < 0x20 || c >= 0x7F)
+      printf("\\u%04x", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
+
+void fatStat(char *str)
+{
+  int i = findString(str);
+  if(i == -1)
+  {
+    printf("Error: File not found.\n");
+    return;
+  }
+  printf("Attribute: \t 0x%x\n", cwd->entries[i].DIR_Attr);
+  printf("Cluster number:\t %u\n", fat32EntryCluster(&cwd->entries[i]));
+  if(cwd->entries[i].DIR_Attr & 0x10)
+    printf("Size: \t\t 0\n");
+  else
+    printf("Size: \t\t %d\n", cwd->entries[i].DIR_FileSize);
+}
+
+void ls()
+{
+  for(int i = 0; cwd != NULL && i < cwd->count; i++)
+  {
+    char filename[12];
+    if(fat32IsVisible(&cwd->entries[i]))
+      printf("%s\n", displayName(cwd, i, filename));
+  }
+}
+
+// returns the long name of an entry if it has one, otherwise its 11 byte 8.3 name copied into
+// buffer, which has to hold 12 bytes
+const char *displayName(struct Directory *d, int index, char *buffer)
+{
+  if(d->longNames[index] != NULL)
+    return d->longNames[index];
+  strncpy(buffer, &d->entries[index].DIR_Name[0], 11);
+  buffer[11] = '\0';
+  return buffer;
+}
+
+int findString(char * str)
+{
+  return findEntry(cwd, str);
+}
+
+// returns the index of the entry called str in d, or -1 if there is none
+int findEntry(struct Directory *d, const char *str)
+{
+  char normalized[11];
+  // a slot that failed to load has no entries and no usable index
+  if(str == NULL || d == NULL || d->dir == NULL || d->hashSize == 0)
+    return -1;
+  uint32_t mask = d->hashSize - 1;
+  if(fat32NormalizeName(str, normalized) == 0)
+  {
+    for(uint32_t slot = hashName(normalized) & mask; d->hash[slot] != -1; slot = (slot + 1) & mask)
+    {
+      if(memcmp(d->entries[d->hash[slot]].DIR_Name, normalized, 11) == 0)
+        return d->hash[slot];
+    }
+  }
+  // not a short name, try the long names
+  for(uint32_t slot = hashLongName(str) & mask; d->longHash[slot] != -1; slot = (slot + 1) & mask)
+  {
+    if(strcasecmp(d->longNames[d->longHash[slot]], str) == 0)
+      return d->longHash[slot];
+  }
+  return -1;
+}
+
+// FNV-1a hash of a long name, folding ASCII case so lookups are case insensitive
+uint32_t hashLongName(const char *name)
+{
+  uint32_t hash = 2166136261u;
+  for(; *name != '\0'; name++)
+  {
+    hash ^= (uint8_t)tolower(*name);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// FNV-1a hash of an 11 byte on disk name
+uint32_t hashName(const char *name)
+{
+  uint32_t hash = 2166136261u;
+  for(int i = 0; i < 11; i++)
+  {
+    hash ^= (uint8_t)name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+void populateDirArr()
+{
+  cwd = getDirectory(info->BPB_RootClus);
+}
+
+/*
+ * parameters  : The first cluster of a directory, 0 meaning the root directory
+ * returns     : The directory, or NULL if it could not be read
+ * description : Looks the directory up in the directory cache and reads it in if it is not
+ *              there, replacing the least recently used directory other than the current one.
+ */
+struct Directory *getDirectory(uint32_t cluster)
+{
+  // ".." entries of directories right below the root point at cluster 0
+  if(cluster == 0)
+    cluster = info->BPB_RootClus;
+  struct Directory *victim = NULL;
+  for(int i = 0; i < DIR_CACHE_SIZE; i++)
+  {
+    struct Directory *d = &dirCache[i];
+    // an empty slot has cluster 0 as well, only a loaded one can be a match
+    if(d->dir != NULL && d->cluster == cluster)
+    {
+      d->lastUsed = ++dirTick;
+      return d;
+    }
+    if(d != cwd && (victim == NULL || d->lastUsed < victim->lastUsed))
+      victim = d;
+  }
+  if(loadDirectory(victim, cluster) == -1)
+    return NULL;
+  victim->lastUsed = ++dirTick;
+  return victim;
+}
+
+/*
+ * parameters  : A directory cache slot and the first cluster of a directory
+ * returns     : 0 on success, -1 if the directory could not be read
+ * description : Has the library read the directory and put its long names together, then
+ *              builds the name index used by findEntry(). On failure the slot is left empty.
+ *              Only touches the slot it is given, so threads may load into slots of their own.
+ */
+int loadDirectory(struct Directory *d, uint32_t cluster)
+{
+  fat32CloseDir(d->dir);
+  d->dir = fat32OpenDir(volume, cluster);
+  d->cluster = 0;
+  d->count = 0;
+  if(d->dir == NULL)
+    return -1;
+  d->entries = fat32DirEntries(d->dir);
+  d->longNames = fat32DirLongNames(d->dir);
+  d->count = fat32DirCount(d->dir);
+
+  // the indexes are kept at most half full so probe sequences stay short
+  int size = 16;
+  while(size < d->count * 2)
+    size *= 2;
+  if(size != d->hashSize)
+  {
+    free(d->hash);
+    free(d->longHash);
+    d->hash = (int *)malloc(sizeof(int) * size);
+    d->longHash = (int *)malloc(sizeof(int) * size);
+    d->hashSize = size;
+    if(d->hash == NULL || d->longHash == NULL)
+    {
+      free(d->hash);
+      free(d->longHash);
+      d->hash = NULL;
+      d->longHash = NULL;
+      d->hashSize = 0;
+      fat32CloseDir(d->dir);
+      d->dir = NULL;
+      d->count = 0;
+      return -1;
+    }
+  }
+  memset(d->hash, -1, sizeof(int) * size);
+  memset(d->longHash, -1, sizeof(int) * size);
+  uint32_t mask = size - 1;
+  for(int i = 0; i < d->count; i++)
+  {
+    if(!fat32IsVisible(&d->entries[i]))
+      continue;
+    uint32_t slot = hashName(d->entries[i].DIR_Name) & mask;
+    while(d->hash[slot] != -1 &&
+          memcmp(d->entries[d->hash[slot]].DIR_Name, d->entries[i].DIR_Name, 11) != 0)
+      slot = (slot + 1) & mask;
+    // on duplicate names the first entry wins, like a linear search would
+    if(d->hash[slot] == -1)
+      d->hash[slot] = i;
+
+    if(d->longNames[i] == NULL)
+      continue;
+    slot = hashLongName(d->longNames[i]) & mask;
+    while(d->longHash[slot] != -1 &&
+          strcasecmp(d->longNames[d->longHash[slot]], d->longNames[i]) != 0)
+      slot = (slot + 1) & mask;
+    if(d->longHash[slot] == -1)
+      d->longHash[slot] = i;
+  }
+  d->cluster = cluster;
+  return 0;
+}
+
+void dirCacheFree()
+{
+  for(int i = 0; i < DIR_CACHE_SIZE; i++)
+    dirRelease(&dirCache[i]);
+  cwd = NULL;
+  dirTick = 0;
+}
+
+// frees everything a loaded directory holds and leaves it empty
+void dirRelease(struct Directory *d)
+{
+  fat32CloseDir(d->dir);
+  free(d->hash);
+  free(d->longHash);
+  memset(d, 0, sizeof(struct Directory));
+}
+
+void fatGet(char * str)
+{
+  int index = findString(str);
+  if(index == -1)
+  {
+    printf("Error: File not found.\n");
+    return;
+  }
+  int outputFd = open(str, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(outputFd == -1)
+  {
+    printf("Error: Could not create %s.\n", str);
+    return;
+  }
+  
+  struct Fat32ExtentMap *map = getExtents(fat32EntryCluster(&cwd->entries[index]));
+  if(copyFile(map, cwd->entries[index].DIR_FileSize, outputFd) == -1)
+    printf("Error: Could not write %s.\n", str);
+  close(outputFd);
+}
+
+/*
+ * parameters  : A file on the host
+ * description : Copies the file into the current directory under its own name. The data goes
+ *              in first, then every FAT copy and FSInfo, and the directory entry last, so an
+ *              interrupted put leaves at worst a lost chain behind. Names that are not plain
+ *              upper case 8.3 names get long name entries and a generated short alias. The
+ *              directory grows by a cluster when it has no room left for the entries.
+ */
+void fatPut(char *path)
+{
+  if(path == NULL)
+  {
+    printf("Error: Usage is put <filename>.\n");
+    return;
+  }
+  if(!fat32Writable(volume))
+  {
+    printf("Error: File system image is read only.\n");
+    return;
+  }
+  if(cwd == NULL || cwd->dir == NULL)
+  {
+    printf("Error: Current directory could not be read.\n");
+    return;
+  }
+  const char *name = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+  if(findString((char *)name) != -1)
+  {
+    printf("Error: File already exists.\n");
+    return;
+  }
+  int inFd = open(path, O_RDONLY);
+  struct stat st;
+  if(inFd == -1 || fstat(inFd, &st) == -1 || !S_ISREG(st.st_mode))
+  {
+    printf("Error: File not found.\n");
+    if(inFd != -1)
+      close(inFd);
+    return;
+  }
+  struct Fat32DirEntry entries[MAX_LONG_NAME / 13 + 3];
+  int count = makeEntries(name, entries, st.st_mtime);
+  if(count == -1 || st.st_size > UINT32_MAX)
+  {
+    printf("Error: %s can not be stored on a FAT32 volume.\n", name);
+    close(inFd);
+    return;
+  }
+
+  struct Fat32ExtentMap dirMap;
+  fat32BuildExtents(volume, cwd->cluster, &dirMap);
+  // a directory without a chain has nowhere to put the entries, whatever the free space
+  if(dirMap.count == 0)
+  {
+    printf("Error: Current directory could not be read.\n");
+    free(dirMap.extents);
+    close(inFd);
+    return;
+  }
+  int total = (int64_t)dirMap.clusters * info->clusterSize / sizeof(struct Fat32DirEntry);
+  int slot = findFreeSlots(cwd, total, count);
+  uint32_t grow = 0;
+  if(slot + count > total)
+    grow = ((slot + count - total) * sizeof(struct Fat32DirEntry) + info->clusterSize - 1) /
+           info->clusterSize;
+  uint32_t needed = (st.st_size + info->clusterSize - 1) / info->clusterSize;
+  uint32_t *clusters = (uint32_t *)malloc(sizeof(uint32_t) * (needed + grow + 1));
+  if(clusters == NULL || freeMapLoad() == -1)
+  {
+    printf("Error: Out of memory.\n");
+    free(clusters);
+    free(dirMap.extents);
+    close(inFd);
+    return;
+  }
+  if(needed + grow > freeClusters)
+  {
+    printf("Error: Not enough free space.\n");
+    free(clusters);
+    free(dirMap.extents);
+    close(inFd);
+    return;
+  }
+
+  // the data goes in first so a failure can still be backed out of by not linking the chain
+  if(allocClusters(needed, clusters) == -1)
+  {
+    printf("Error: Not enough free space.\n");
+    free(clusters);
+    free(dirMap.extents);
+    close(inFd);
+    return;
+  }
+  struct Fat32ExtentMap fileMap;
+  fat32BuildExtents(volume, needed ? clusters[0] : 0, &fileMap);
+  int failed = copyIntoExtents(&fileMap, st.st_size, inFd) == -1;
+  free(fileMap.extents);
+  close(inFd);
+  uint32_t grown = 0;            // directory clusters taken so far
+  if(!failed && grow > 0)
+  {
+    failed = allocClusters(grow, clusters + needed) == -1;
+    if(!failed)
+      grown = grow;
+    uint8_t *zero = (uint8_t *)calloc(1, info->clusterSize);
+    failed = failed || zero == NULL;
+    for(uint32_t i = 0; i < grown && !failed; i++)
+      failed = fat32Write(volume, zero, fat32ClusterOffset(volume, clusters[needed + i]),
+                          info->clusterSize) == -1;
+    free(zero);
+    // the directory only gets its new clusters once all of them are zeroed, stale data in
+    // them would otherwise read as entries
+    if(!failed)
+    {
+      struct Fat32Extent *last = &dirMap.extents[dirMap.count - 1];
+      fat32SetEntry(volume, last->diskCluster + last->count - 1, clusters[needed]);
+      free(dirMap.extents);
+      fat32BuildExtents(volume, cwd->cluster, &dirMap);
+    }
+  }
+  if(failed)
+  {
+    // nothing points at the new clusters yet, hand the file's and the directory's back
+    for(uint32_t i = 0; i < needed + grown; i++)
+    {
+      fat32SetEntry(volume, clusters[i], 0);
+      freeMap[clusters[i] / 64] |= 1ULL << (clusters[i] % 64);
+      freeClusters++;
+    }
+    fatFlush();
+    printf("Error: Could not write %s.\n", name);
+  }
+  else
+  {
+    entries[count - 1].DIR_FirstClusterHigh = needed ? clusters[0] >> 16 : 0;
+    entries[count - 1].DIR_FirstClusterLow = needed ? clusters[0] & 0xFFFF : 0;
+    entries[count - 1].DIR_FileSize = st.st_size;
+    // entries written past the end of directory marker need a new marker after them, unless
+    // they run into freshly zeroed clusters
+    int written = count;
+    if(slot + count >= cwd->count && slot + count < total)
+      memset(&entries[written++], 0, sizeof(struct Fat32DirEntry));
+    if(fatFlush() == -1 ||
+       fat32ExtentWrite(volume, &dirMap, entries, (int64_t)slot * sizeof(struct Fat32DirEntry),
+                        written * sizeof(struct Fat32DirEntry)) !=
+       (int64_t)(written * sizeof(struct Fat32DirEntry)))
+      printf("Error: Could not write %s.\n", name);
+  }
+  free(dirMap.extents);
+  free(clusters);
+  writeDone();
+}
+
+/*
+ * parameters  : The name of a file in the current directory
+ * description : Marks the file's entry and its long name entries deleted, then frees its chain
+ *              in every FAT copy. The entry goes first so an interrupted del leaves at worst a
+ *              lost chain behind, never an entry pointing at free clusters.
+ */
+void fatDel(char *name)
+{
+  if(name == NULL)
+  {
+    printf("Error: Usage is del <filename>.\n");
+    return;
+  }
+  if(!fat32Writable(volume))
+  {
+    printf("Error: File system image is read only.\n");
+    return;
+  }
+  int index = findString(name);
+  if(index == -1)
+  {
+    printf("Error: File not found.\n");
+    return;
+  }
+  struct Fat32DirEntry *entry = &cwd->entries[index];
+  if(entry->DIR_Attr & 0x10)
+  {
+    printf("Error: %s is a directory.\n", name);
+    return;
+  }
+  if(freeMapLoad() == -1)
+  {
+    printf("Error: Could not read the FAT.\n");
+    return;
+  }
+  uint32_t cluster = fat32EntryCluster(entry);
+
+  // the long name entries belonging to the file sit right in front of it
+  uint8_t checksum = fat32ShortNameChecksum(entry->DIR_Name);
+  int first = index;
+  while(first > 0 && (cwd->entries[first - 1].DIR_Attr & 0x3F) == 0x0F &&
+        (uint8_t)cwd->entries[first - 1].DIR_Name[0] != 0xE5 &&
+        ((uint8_t *)&cwd->entries[first - 1])[13] == checksum)
+    first--;
+  int count = index - first + 1;
+  struct Fat32DirEntry *deleted = (struct Fat32DirEntry *)malloc(sizeof(struct Fat32DirEntry) * count);
+  memcpy(deleted, &cwd->entries[first], sizeof(struct Fat32DirEntry) * count);
+  for(int i = 0; i < count; i++)
+    deleted[i].DIR_Name[0] = (char)0xE5;
+  struct Fat32ExtentMap dirMap;
+  fat32BuildExtents(volume, cwd->cluster, &dirMap);
+  int64_t bytes = count * sizeof(struct Fat32DirEntry);
+  int64_t done = fat32ExtentWrite(volume, &dirMap, deleted, (int64_t)first * sizeof(struct Fat32DirEntry),
+                                  bytes);
+  free(dirMap.extents);
+  free(deleted);
+  if(done != bytes)
+  {
+    printf("Error: Could not delete %s.\n", name);
+    writeDone();
+    return;
+  }
+
+  // the walk is bounded by the cluster count so a looping chain can not keep it going
+  for(uint32_t i = 0; i < info->clusterCount && cluster >= 2 && cluster < info->clusterCount + 2;
+      i++)
+  {
+    uint32_t next = fat32Entry(volume, cluster);
+    if(next == 0 || next == FAT32_BAD_CLUSTER)
+      break;
+    fat32SetEntry(volume, cluster, 0);
+    freeMap[cluster / 64] |= 1ULL << (cluster % 64);
+    freeClusters++;
+    if(next > FAT32_BAD_CLUSTER)
+      break;
+    cluster = next;
+  }
+  if(fatFlush() == -1)
+    printf("Error: Could not update the FAT.\n");
+  writeDone();
+}
+
+// forgets everything cached about the current directory and the clusters after a put or del
+void writeDone()
+{
+  dentryClear();
+  extentCacheFree();
+  if(loadDirectory(cwd, cwd->cluster) == -1)
+    cwd = getDirectory(info->BPB_RootClus);
+}
+
+/*
+ * parameters  : A host file name, room for MAX_LONG_NAME / 13 + 2 entries and the file's
+ *              modification time
+ * returns     : How many entries were filled in, -1 if the name can not be used
+ * description : Builds the directory entries for a new file, its long name entries in the
+ *              order they go on disk followed by the 8.3 entry. Only the cluster and size of
+ *              the 8.3 entry are left for the caller. A plain upper case 8.3 name is stored as
+ *              it is, anything else gets a long name. Its alias is the name upper cased when
+ *              that is a free 8.3 name, otherwise a "BASIS~N" that is not taken yet in the
+ *              current directory.
+ */
+int makeEntries(const char *name, struct Fat32DirEntry *entries, time_t modified)
+{
+  char shortName[11];
+  uint16_t chars[MAX_LONG_NAME + 13];
+  if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strpbrk(name, "\\/:*?\"<>|") != NULL)
+    return -1;
+  int length = fat32Utf8ToUcs2(name, chars, MAX_LONG_NAME);
+  if(length < 1)
+    return -1;
+
+  // a name that only differs from a valid 8.3 name in case keeps it as its alias
+  int valid = fat32NormalizeName(name, shortName) == 0;
+  int plain = valid;
+  for(const char *c = name; valid && *c != '\0'; c++)
+  {
+    valid = isalnum((uint8_t)*c) || strchr("._-$~!#%&@^'`(){}", *c) != NULL;
+    plain = plain && !islower((uint8_t)*c);
+  }
+  plain = plain && valid;
+  if(!valid || shortNameTaken(cwd, shortName))
+  {
+    plain = 0;
+    // the basis name keeps the characters 8.3 names allow, the extension comes from the part
+    // after the last dot
+    const char *dot = strrchr(name, '.');
+    char basis[8];
+    int baseLength = 0;
+    memset(shortName, ' ', 11);
+    for(const char *c = name; *c != '\0' && c != dot; c++)
+    {
+      // spaces and dots are dropped, a multi byte character turns into a single '_'
+      if(*c == ' ' || *c == '.' || (*c & 0xC0) == 0x80)
+        continue;
+      if(baseLength < 8)
+        basis[baseLength++] = isalnum((uint8_t)*c) ? toupper((uint8_t)*c) : '_';
+    }
+    for(int i = 0, j = 0; dot != NULL && dot[1 + i] != '\0' && j < 3; i++)
+    {
+      if(dot[1 + i] != ' ' && (dot[1 + i] & 0xC0) != 0x80)
+        shortName[8 + j++] = isalnum((uint8_t)dot[1 + i]) ? toupper((uint8_t)dot[1 + i]) : '_';
+    }
+    if(baseLength == 0)
+      basis[baseLength++] = '_';
+    int tail = 1;
+    do
+    {
+      char suffix[16];
+      int suffixLength = sprintf(suffix, "~%d", tail++);
+      int keep = baseLength + suffixLength > 8 ? 8 - suffixLength : baseLength;
+      memset(shortName, ' ', 8);
+      memcpy(shortName, basis, keep);
+      memcpy(shortName + keep, suffix, suffixLength);
+    } while(shortNameTaken(cwd, shortName) && tail < 1000000);
+  }
+
+  int count = 0;
+  if(!plain)
+  {
+    // the name ends with a 0x0000 unless it fills its last entry, then 0xFFFF pads the rest
+    int pieces = (length + 12) / 13;
+    chars[length] = 0x0000;
+    for(int i = length + 1; i < pieces * 13; i++)
+      chars[i] = 0xFFFF;
+    uint8_t checksum = fat32ShortNameChecksum(shortName);
+    for(int ordinal = pieces; ordinal >= 1; ordinal--)
+    {
+      uint8_t *raw = (uint8_t *)&entries[count++];
+      uint16_t *part = &chars[(ordinal - 1) * 13];
+      memset(raw, 0, sizeof(struct Fat32DirEntry));
+      raw[0] = ordinal | (ordinal == pieces ? 0x40 : 0);
+      memcpy(raw + 1, part, 10);
+      raw[11] = 0x0F;
+      raw[13] = checksum;
+      memcpy(raw + 14, part + 5, 12);
+      memcpy(raw + 28, part + 11, 4);
+    }
+  }
+  struct Fat32DirEntry *entry = &entries[count++];
+  memset(entry, 0, sizeof(struct Fat32DirEntry));
+  memcpy(entry->DIR_Name, shortName, 11);
+  entry->DIR_Attr = 0x20;
+  // creation and last access are now, the last write time is the host file's
+  uint8_t *raw = (uint8_t *)entry;
+  time_t now = time(NULL);
+  fatTimestamp(now, raw + 16, raw + 14);
+  fatTimestamp(now, raw + 18, NULL);
+  fatTimestamp(modified, raw + 24, raw + 22);
+  return count;
+}
+
+// returns 1 if some entry of d already uses the 11 byte 8.3 name
+int shortNameTaken(struct Directory *d, const char *name)
+{
+  for(int i = 0; i < d->count; i++)
+  {
+    if((uint8_t)d->entries[i].DIR_Name[0] != 0xE5 && memcmp(d->entries[i].DIR_Name, name, 11) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+// returns the first slot of a run of count free entries in d, which holds total slots. a run at
+// the end may go past total, in which case the directory has to grow
+int findFreeSlots(struct Directory *d, int total, int count)
+{
+  int run = 0;
+  for(int i = 0; i < total; i++)
+  {
+    // everything from the end of directory marker on is free
+    if(i >= d->count)
+      return i - run;
+    if((uint8_t)d->entries[i].DIR_Name[0] == 0xE5)
+      run++;
+    else
+      run = 0;
+    if(run == count)
+      return i - run + 1;
+  }
+  return total - run;
+}
+
+// packs a time into the on disk date and, if time is not NULL, time fields of an entry
+void fatTimestamp(time_t when, uint8_t *date, uint8_t *time)
+{
+  struct tm tm;
+  localtime_r(&when, &tm);
+  // FAT dates start in 1980
+  if(tm.tm_year < 80)
+  {
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = 80;
+    tm.tm_mday = 1;
+  }
+  uint16_t packedDate = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+  uint16_t packedTime = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+  memcpy(date, &packedDate, 2);
+  if(time != NULL)
+    memcpy(time, &packedTime, 2);
+}
+
+// unpacks the on disk date and time fields of an entry, the reverse of fatTimestamp(). an
+// entry that was never given a date comes out as 0
+time_t fatTime(const uint8_t *date, const uint8_t *time)
+{
+  uint16_t packedDate;
+  uint16_t packedTime;
+  memcpy(&packedDate, date, 2);
+  memcpy(&packedTime, time, 2);
+  if(packedDate == 0)
+    return 0;
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  tm.tm_year = (packedDate >> 9) + 80;
+  tm.tm_mon = ((packedDate >> 5) & 0x0F) - 1;
+  tm.tm_mday = packedDate & 0x1F;
+  tm.tm_hour = packedTime >> 11;
+  tm.tm_min = (packedTime >> 5) & 0x3F;
+  tm.tm_sec = (packedTime & 0x1F) * 2;
+  tm.tm_isdst = -1;
+  time_t when = mktime(&tm);
+  return when == -1 ? 0 : when;
+}
+
+/*
+ * parameters  : A directory in the image and a directory on the host
+ * description : Extracts the whole tree under src into dest. The tree is walked first, making
+ *              the host directories and collecting every file with a private copy of its
+ *              extents. The files are then sorted by where they start on disk and handed out to
+ *              a pool of threads that copy them with copyExtents(). Every thread only uses
+ *              positioned reads on the shared descriptor so none of them disturb each other,
+ *              and taking the files in disk order keeps the reads mostly sequential.
+ */
+void fatGetTree(char *src, char *dest)
+{
+  uint32_t cluster;
+  if(src == NULL || dest == NULL)
+  {
+    printf("Error: Usage is get -r <directory> <destination>.\n");
+    return;
+  }
+  if(resolvePath(src, &cluster) == -1)
+  {
+    printf("Error: Subdirectory not found.\n");
+    return;
+  }
+  if(mkdir(dest, 0755) == -1 && errno != EEXIST)
+  {
+    printf("Error: Could not create %s.\n", dest);
+    return;
+  }
+
+  struct GetJobList list;
+  memset(&list, 0, sizeof(list));
+  collectTree(&list, cluster, dest, 0);
+  qsort(list.jobs, list.count, sizeof(struct GetJob), compareJobs);
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  // copying mostly waits on the disk so a few more threads than cores still pay off
+  int threads = cpus < 1 ? 2 : cpus * 2;
+  if(threads > MAX_THREADS)
+    threads = MAX_THREADS;
+  if(threads > list.count)
+    threads = list.count;
+  pthread_t tids[MAX_THREADS];
+  int started = 0;
+  for(; started < threads; started++)
+  {
+    if(pthread_create(&tids[started], NULL, getWorker, &list) != 0)
+      break;
+  }
+  // with no threads at all the work still gets done on this one
+  if(started == 0)
+    getWorker(&list);
+  for(int i = 0; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  for(int i = 0; i < list.count; i++)
+  {
+    free(list.jobs[i].path);
+    free(list.jobs[i].map.extents);
+  }
+  free(list.jobs);
+}
+
+/*
+ * parameters  : The job list, a directory in the image, its host counterpart and its depth
+ * returns     : 0 on success, -1 if the directory could not be read
+ * description : Adds every file below the directory to the list and makes the host directories
+ *              as it goes. Every file and directory counts, whatever its read only, hidden or
+ *              system bits, and a directory that can not be read is reported, not dropped.
+ *              The directory is loaded outside of the directory cache so walking a big tree
+ *              does not push out the directories cd is using.
+ */
+int collectTree(struct GetJobList *list, uint32_t cluster, const char *hostDir, int depth)
+{
+  struct Directory d;
+  memset(&d, 0, sizeof(d));
+  // whatever is left out gets named, a tree that comes out incomplete must not look whole
+  const char *shown = hostDir[0] != '\0' ? hostDir : ".";
+  if(depth > MAX_TREE_DEPTH)
+  {
+    printf("Error: %s/ is nested too deeply, it is left out.\n", shown);
+    return -1;
+  }
+  if(loadDirectory(&d, cluster == 0 ? info->BPB_RootClus : cluster) == -1)
+  {
+    printf("Error: Could not read %s/, it is left out.\n", shown);
+    dirRelease(&d);
+    return -1;
+  }
+  for(int i = 0; i < d.count; i++)
+  {
+    struct Fat32DirEntry *e = &d.entries[i];
+    if(!fat32IsVisible(e) || e->DIR_Name[0] == '.')
+      continue;
+    char buffer[13];
+    const char *name = hostName(&d, i, buffer);
+    char *path = (char *)malloc(strlen(hostDir) + strlen(name) + 2);
+    // the archive names of export start out with no directory in front of them
+    sprintf(path, "%s%s%s", hostDir, hostDir[0] != '\0' ? "/" : "", name);
+    if((e->DIR_Attr & 0x10) && !list->archive)
+    {
+      if(mkdir(path, 0755) == -1 && errno != EEXIST)
+        printf("Error: Could not create %s.\n", path);
+      else
+        collectTree(list, fat32EntryCluster(e), path, depth + 1);
+      free(path);
+      continue;
+    }
+    if(list->count == list->capacity)
+    {
+      list->capacity = list->capacity ? list->capacity * 2 : 64;
+      list->jobs = (struct GetJob *)realloc(list->jobs, sizeof(struct GetJob) * list->capacity);
+    }
+    struct GetJob *job = &list->jobs[list->count++];
+    const uint8_t *raw = (const uint8_t *)e;
+    job->path = path;
+    job->attr = e->DIR_Attr;
+    job->modified = fatTime(raw + 24, raw + 22);
+    if(e->DIR_Attr & 0x10)
+    {
+      // an archived directory is a job of its own, the list may move once it is walked
+      job->size = 0;
+      memset(&job->map, 0, sizeof(job->map));
+      collectTree(list, fat32EntryCluster(e), path, depth + 1);
+      continue;
+    }
+    struct Fat32ExtentMap *map = getExtents(fat32EntryCluster(e));
+    job->size = e->DIR_FileSize;
+    job->map = *map;
+    job->map.extents = (struct Fat32Extent *)malloc(sizeof(struct Fat32Extent) * (map->count + 1));
+    memcpy(job->map.extents, map->extents, sizeof(struct Fat32Extent) * map->count);
+  }
+  dirRelease(&d);
+  return 0;
+}
+
+// thread body for get -r, copies files until the list runs out
+void *getWorker(void *arg)
+{
+  struct GetJobList *list = arg;
+  int i;
+  while((i = __atomic_fetch_add(&list->next, 1, __ATOMIC_RELAXED)) < list->count)
+  {
+    struct GetJob *job = &list->jobs[i];
+    int fd = open(job->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1 || copyExtents(&job->map, job->size, fd) == -1)
+      printf("Error: Could not write %s.\n", job->path);
+    if(fd != -1)
+      close(fd);
+  }
+  return NULL;
+}
+
+// orders jobs by the cluster their data starts at, directories and empty files first in path
+// order, which puts every directory in front of what is inside it
+int compareJobs(const void *a, const void *b)
+{
+  const struct GetJob *x = a;
+  const struct GetJob *y = b;
+  uint32_t cx = x->map.count ? x->map.extents[0].diskCluster : 0;
+  uint32_t cy = y->map.count ? y->map.extents[0].diskCluster : 0;
+  if(cx == cy)
+    return strcmp(x->path, y->path);
+  return (cx > cy) - (cx < cy);
+}
+
+/*
+ * parameters  : A directory in the image and a file on the host
+ * description : Streams the tree under src out as a POSIX tar archive. The tree is walked the
+ *              way get -r walks it, only nothing is made on the host. The directories go first,
+ *              then the files in the order their data sits on disk, so the image is read in
+ *              one sweep. Headers and small files are gathered in one large buffer, bigger
+ *              files are copied with copyFile(), which keeps their data inside the kernel when
+ *              it can. Standard output carries the prompt, the errors and in batch mode the
+ *              JSON records, so an archive meant for a pipe goes to an inherited descriptor
+ *              instead ("export / /dev/fd/3" run with 3>&1).
+ */
+void fatExport(char *src, char *dest)
+{
+  uint32_t cluster;
+  if(src == NULL || dest == NULL)
+  {
+    printf("Error: Usage is export <directory> <file>.\n");
+    return;
+  }
+  if(resolvePath(src, &cluster) == -1)
+  {
+    printf("Error: Subdirectory not found.\n");
+    return;
+  }
+  struct TarWriter w;
+  memset(&w, 0, sizeof(w));
+  if(strcmp(dest, "-") == 0)
+  {
+    printf("Error: The archive can not share standard output, use /dev/fd/3 with 3>&1.\n");
+    return;
+  }
+  w.fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(w.fd == -1)
+  {
+    printf("Error: Could not create %s.\n", dest);
+    return;
+  }
+  if(posix_memalign((void **)&w.buffer, 4096, TAR_BUFFER_SIZE) != 0)
+  {
+    printf("Error: Out of memory.\n");
+    close(w.fd);
+    return;
+  }
+
+  struct GetJobList list;
+  memset(&list, 0, sizeof(list));
+  list.archive = 1;
+  collectTree(&list, cluster, "", 0);
+  qsort(list.jobs, list.count, sizeof(struct GetJob), compareJobs);
+  for(int i = 0; i < list.count && !w.failed; i++)
+  {
+    if(exportJob(&w, &list.jobs[i]) == -1)
+      printf("Error: Could not read %s, its data is zero filled.\n", list.jobs[i].path);
+  }
+  // the archive ends with two blocks of zeros
+  tarPad(&w, 0);
+  tarAppend(&w, NULL, 1024);
+  tarFlush(&w);
+  if(w.failed)
+    printf("Error: Could not write %s.\n", dest);
+
+  for(int i = 0; i < list.count; i++)
+  {
+    free(list.jobs[i].path);
+    free(list.jobs[i].map.extents);
+  }
+  free(list.jobs);
+  free(w.buffer);
+  close(w.fd);
+}
+
+/*
+ * parameters  : The tar stream and one file or directory of the tree
+ * returns     : 0 on success, -1 if the file's data could not all be read from the image
+ * description : Adds the header of the job and, for a file, its data. Whatever is missing,
+ *              a chain shorter than the size or a failed read, is written as zeros so the
+ *              archive stays whole.
+ */
+int exportJob(struct TarWriter *w, struct GetJob *job)
+{
+  int dir = (job->attr & 0x10) != 0;
+  // read only entries lose their write bits like they would on a FAT mount
+  int mode = (dir ? 0755 : 0644) & (job->attr & 0x01 ? ~0222 : ~0);
+  if(tarHeader(w, job->path, dir ? '5' : '0', job->size, job->modified, mode) == -1 || dir)
+    return 0;
+
+  int64_t have = (int64_t)job->map.clusters * info->clusterSize;
+  int64_t size = job->size < have ? job->size : have;
+  int ret = 0;
+  if(job->size <= TAR_SMALL_FILE)
+  {
+    if(TAR_BUFFER_SIZE - w->filled < (size_t)size)
+      tarFlush(w);
+    if(readExtents(&job->map, size, w->buffer + w->filled) == 0)
+      w->filled += size;
+    else
+      size = 0;
+  }
+  else
+  {
+    tarFlush(w);
+    if(!w->failed && copyFile(&job->map, size, w->fd) == -1)
+    {
+      // the descriptor may be anywhere by now, the archive can not be patched up
+      w->failed = 1;
+      return 0;
+    }
+  }
+  if(size < job->size)
+  {
+    tarAppend(w, NULL, job->size - size);
+    ret = -1;
+  }
+  tarPad(w, job->size);
+  return ret;
+}
+
+/*
+ * parameters  : The tar stream, the name in the archive, '0' for a file or '5' for a directory,
+ *              the size, the modification time and the permission bits
+ * returns     : 0, or -1 if the name can not be stored at all
+ * description : Appends a ustar header. A name that does not fit the 100 byte name field is
+ *              split over the prefix and name fields at a slash, and if that fails too a pax
+ *              extended header carrying the full name goes in front.
+ */
+int tarHeader(struct TarWriter *w, const char *name, char type, uint32_t size, time_t modified,
+              int mode)
+{
+  char header[512];
+  char full[4096];
+  int length = snprintf(full, sizeof(full), "%s%s", name, type == '5' ? "/" : "");
+  if(length >= (int)sizeof(full))
+    return -1;
+
+  memset(header, 0, sizeof(header));
+  if(length <= 100)
+    memcpy(header, full, length);
+  else
+  {
+    // the prefix has to end right before a slash and leave at most 100 bytes for the name
+    char *slash = NULL;
+    for(char *p = full + length - 1 - (type == '5'); p > full && p >= full + length - 101; p--)
+    {
+      if(*p == '/')
+        slash = p;
+    }
+    if(slash != NULL && slash - full <= 155)
+    {
+      memcpy(header + 345, full, slash - full);
+      memcpy(header, slash + 1, full + length - slash - 1);
+    }
+    else
+    {
+      // "<length> path=<name>\n", where the length counts its own digits
+      int record = length + 7;
+      int total = record;
+      while(record + snprintf(NULL, 0, "%d", total) != total)
+        total = record + snprintf(NULL, 0, "%d", total);
+      char *pax = (char *)malloc(total + 1);
+      snprintf(pax, total + 1, "%d path=%s\n", total, full);
+      tarHeader(w, "PaxHeader", 'x', total, modified, 0644);
+      tarAppend(w, pax, total);
+      tarPad(w, total);
+      free(pax);
+      memcpy(header, full, 100);
+    }
+  }
+  snprintf(header + 100, 8, "%07o", mode);
+  snprintf(header + 108, 8, "%07o", 0);
+  snprintf(header + 116, 8, "%07o", 0);
+  // FAT sizes and dates both fit the 11 octal digits
+  snprintf(header + 124, 12, "%011o", size);
+  snprintf(header + 136, 12, "%011o", (uint32_t)(modified > 0 ? modified : 0));
+  header[156] = type;
+  memcpy(header + 257, "ustar", 6);
+  memcpy(header + 263, "00", 2);
+  // the checksum is taken with its own field set to spaces
+  memset(header + 148, ' ', 8);
+  unsigned sum = 0;
+  for(int i = 0; i < 512; i++)
+    sum += (uint8_t)header[i];
+  snprintf(header + 148, 7, "%06o", sum);
+  tarAppend(w, header, sizeof(header));
+  return 0;
+}
+
+// adds len bytes to the stream, zeros if data is NULL
+void tarAppend(struct TarWriter *w, const void *data, size_t len)
+{
+  const uint8_t *in = data;
+  while(len > 0)
+  {
+    if(w->filled == TAR_BUFFER_SIZE)
+      tarFlush(w);
+    size_t n = len < TAR_BUFFER_SIZE - w->filled ? len : TAR_BUFFER_SIZE - w->filled;
+    if(in != NULL)
+    {
+      memcpy(w->buffer + w->filled, in, n);
+      in += n;
+    }
+    else
+      memset(w->buffer + w->filled, 0, n);
+    w->filled += n;
+    len -= n;
+  }
+}
+
+// pads the data of a size byte member out to a whole 512 byte block
+void tarPad(struct TarWriter *w, uint64_t size)
+{
+  if(size % 512 != 0)
+    tarAppend(w, NULL, 512 - size % 512);
+}
+
+// writes out what has been gathered so far
+void tarFlush(struct TarWriter *w)
+{
+  if(w->filled > 0 && !w->failed && writeAll(w->fd, w->buffer, w->filled) == -1)
+    w->failed = 1;
+  w->filled = 0;
+}
+
+// reads the first size bytes of a file into dst one extent at a time, around the block cache so
+// a big export does not push out the directories. returns -1 if the image could not be read
+int readExtents(struct Fat32ExtentMap *map, int64_t size, uint8_t *dst)
+{
+  for(int i = 0; i < map->count && size > 0; i++)
+  {
+    int64_t run = (int64_t)map->extents[i].count * info->clusterSize;
+    if(run > size)
+      run = size;
+    off_t offset = fat32ClusterOffset(volume, map->extents[i].diskCluster);
+    if(fat32ReadDirect(volume, dst, offset, run) == -1)
+      return -1;
+    dst += run;
+    size -= run;
+  }
+  return 0;
+}
+
+// copies a file out of the image the fastest way there is for it: a fragmented file gets its
+// reads issued ahead of time, a contiguous one copies fastest inside the kernel
+int copyFile(struct Fat32ExtentMap *map, int64_t size, int outFd)
+{
+  int ret = -2;
+  if(map->count >= READAHEAD_MIN_EXTENTS)
+    ret = copyReadahead(map, size, outFd);
+  if(ret == -2)
+    ret = copyExtents(map, size, outFd);
+  return ret;
+}
+
+/*
+ * parameters  : A file in the current directory, or with recursive set a directory
+ * description : Prints the CRC32C and SHA-256 of a file, or of every file below a directory,
+ *              as "<crc32c> <sha256>  <path>" lines. Dropping the first column leaves what
+ *              sha256sum -c reads. The data is read straight from the cluster chains and
+ *              nothing is written to the host. A tree is hashed by a pool of threads taking the
+ *              files in the order they sit on disk, and the lines come out sorted by path.
+ */
+void fatSum(char *name, int recursive)
+{
+  hashInit();
+  if(!recursive)
+  {
+    int index = name == NULL ? -1 : findString(name);
+    if(index == -1)
+    {
+      printf("Error: File not found.\n");
+      return;
+    }
+    uint8_t *buffer = NULL;
+    if(posix_memalign((void **)&buffer, 4096, SUM_BUFFER_SIZE) != 0)
+    {
+      printf("Error: Out of memory.\n");
+      return;
+    }
+    struct SumResult result;
+    memset(&result, 0, sizeof(result));
+    result.path = name;
+    struct Fat32ExtentMap *map = getExtents(fat32EntryCluster(&cwd->entries[index]));
+    sumFile(map, cwd->entries[index].DIR_FileSize, buffer, &result);
+    printSum(&result);
+    free(buffer);
+    return;
+  }
+
+  uint32_t cluster;
+  if(name == NULL)
+  {
+    printf("Error: Usage is sum [-r] <name>.\n");
+    return;
+  }
+  if(resolvePath(name, &cluster) == -1)
+  {
+    printf("Error: Subdirectory not found.\n");
+    return;
+  }
+  struct SumJobs jobs;
+  memset(&jobs, 0, sizeof(jobs));
+  jobs.list.archive = 1;
+  collectTree(&jobs.list, cluster, "", 0);
+  qsort(jobs.list.jobs, jobs.list.count, sizeof(struct GetJob), compareJobs);
+  jobs.results = (struct SumResult *)calloc(jobs.list.count + 1, sizeof(struct SumResult));
+
+  // hashing keeps a core busy, so one thread per core
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int threads = cpus < 1 ? 1 : cpus;
+  if(threads > MAX_THREADS)
+    threads = MAX_THREADS;
+  if(threads > jobs.list.count)
+    threads = jobs.list.count;
+  pthread_t tids[MAX_THREADS];
+  int started = 0;
+  for(; started < threads; started++)
+  {
+    if(pthread_create(&tids[started], NULL, sumWorker, &jobs) != 0)
+      break;
+  }
+  if(started == 0)
+    sumWorker(&jobs);
+  for(int i = 0; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  // the directories were only collected to get to the files inside them
+  int count = 0;
+  for(int i = 0; i < jobs.list.count; i++)
+  {
+    if(!(jobs.list.jobs[i].attr & 0x10))
+      jobs.results[count++] = jobs.results[i];
+  }
+  qsort(jobs.results, count, sizeof(struct SumResult), compareSums);
+  for(int i = 0; i < count; i++)
+    printSum(&jobs.results[i]);
+
+  for(int i = 0; i < jobs.list.count; i++)
+  {
+    free(jobs.list.jobs[i].path);
+    free(jobs.list.jobs[i].map.extents);
+  }
+  free(jobs.list.jobs);
+  free(jobs.results);
+}
+
+// thread body for sum -r, hashes files until the list runs out. a thread that got no buffer
+// still takes its share of the files and marks them failed, so every result gets its path
+void *sumWorker(void *arg)
+{
+  struct SumJobs *jobs = arg;
+  uint8_t *buffer = NULL;
+  if(posix_memalign((void **)&buffer, 4096, SUM_BUFFER_SIZE) != 0)
+    buffer = NULL;
+  int i;
+  while((i = __atomic_fetch_add(&jobs->list.next, 1, __ATOMIC_RELAXED)) < jobs->list.count)
+  {
+    struct GetJob *job = &jobs->list.jobs[i];
+    jobs->results[i].path = job->path;
+    if(job->attr & 0x10)
+      continue;
+    if(buffer == NULL)
+      jobs->results[i].failed = 1;
+    else
+      sumFile(&job->map, job->size, buffer, &jobs->results[i]);
+  }
+  free(buffer);
+  return NULL;
+}
+
+/*
+ * parameters  : The extents of a file, its size, a SUM_BUFFER_SIZE buffer and the result
+ * returns     : 0 on success, -1 if the image could not be read or the chain is too short
+ * description : Reads the file an extent at a time, in pieces of up to a buffer, around the
+ *              block cache, and runs every piece through both checksums.
+ */
+int sumFile(struct Fat32ExtentMap *map, int64_t size, uint8_t *buffer, struct SumResult *result)
+{
+  struct Sha256 sha;
+  uint32_t crc = 0xFFFFFFFF;
+  sha256Init(&sha);
+  for(int i = 0; i < map->count && size > 0; i++)
+  {
+    off_t offset = fat32ClusterOffset(volume, map->extents[i].diskCluster);
+    int64_t run = (int64_t)map->extents[i].count * info->clusterSize;
+    if(run > size)
+      run = size;
+    size -= run;
+    while(run > 0)
+    {
+      size_t n = run < SUM_BUFFER_SIZE ? run : SUM_BUFFER_SIZE;
+      if(fat32ReadDirect(volume, buffer, offset, n) == -1)
+      {
+        result->failed = 1;
+        return -1;
+      }
+      crc = crc32c(crc, buffer, n);
+      sha256Update(&sha, buffer, n);
+      offset += n;
+      run -= n;
+    }
+  }
+  result->failed = size > 0;
+  result->crc = crc ^ 0xFFFFFFFF;
+  sha256Final(&sha, result->sha);
+  return result->failed ? -1 : 0;
+}
+
+// prints one line of sum's output
+void printSum(struct SumResult *result)
+{
+  if(result->failed)
+  {
+    printf("Error: Could not read %s.\n", result->path);
+    return;
+  }
+  char hex[65];
+  for(int i = 0; i < 32; i++)
+    sprintf(hex + i * 2, "%02x", result->sha[i]);
+  printf("%08x %s  %s\n", result->crc, hex, result->path);
+}
+
+// orders sum results by path
+int compareSums(const void *a, const void *b)
+{
+  return strcmp(((const struct SumResult *)a)->path, ((const struct SumResult *)b)->path);
+}
+
+// returns the name an entry gets on the host: its long name, or the 8.3 name written the usual
+// way ("FOO.TXT") in buffer, which has to hold 13 bytes
+const char *hostName(struct Directory *d, int index, char *buffer)
+{
+  if(d->longNames[index] != NULL)
+    return d->longNames[index];
+  return fat32ShortName(d->entries[index].DIR_Name, buffer);
+}
+
+/*
+ * parameters  : An extent map, the number of bytes of the file and a descriptor to write to
+ * returns     : 0 on success, -1 if reading the image or writing the output failed or the chain
+ *              ends before the file does
+ * description : Copies a file out of the image one extent at a time. copy_file_range() lets the
+ *              kernel move the data without it ever reaching user space, sendfile() is tried
+ *              next, and if neither works the extents are pread() into a page aligned buffer
+ *              that gets written out whenever it fills up. Small extents therefore still end up
+ *              as large writes.
+ */
+int copyExtents(struct Fat32ExtentMap *map, int64_t size, int outFd)
+{
+  int mode = 0;                 // 0 copy_file_range, 1 sendfile, 2 pread + write
+  uint8_t *buffer = NULL;
+  size_t filled = 0;
+  int ret = 0;
+  for(int i = 0; i < map->count && size > 0 && ret == 0; i++)
+  {
+    off_t offset = fat32ClusterOffset(volume, map->extents[i].diskCluster);
+    int64_t run = (int64_t)map->extents[i].count * info->clusterSize;
+    if(run > size)
+      run = size;
+    size -= run;
+    while(run > 0)
+    {
+      ssize_t n = -1;
+      if(mode == 0)
+      {
+        n = copy_file_range(fat32Descriptor(volume), &offset, outFd, NULL, run, 0);
+        if(n <= 0)
+        {
+          mode = 1;
+          continue;
+        }
+        fat32CountRead(volume, offset - n, n);
+      }
+      else if(mode == 1)
+      {
+        n = sendfile(outFd, fat32Descriptor(volume), &offset, run);
+        if(n <= 0)
+        {
+          mode = 2;
+          continue;
+        }
+        fat32CountRead(volume, offset - n, n);
+      }
+      else
+      {
+        if(buffer == NULL && posix_memalign((void **)&buffer, 4096, COPY_BUFFER_SIZE) != 0)
+        {
+          buffer = NULL;
+          ret = -1;
+          break;
+        }
+        size_t want = run < COPY_BUFFER_SIZE - filled ? run : COPY_BUFFER_SIZE - filled;
+        n = pread(fat32Descriptor(volume), buffer + filled, want, offset);
+        if(n <= 0)
+        {
+          ret = -1;
+          break;
+        }
+        fat32CountRead(volume, offset, n);
+        offset += n;
+        filled += n;
+        if(filled == COPY_BUFFER_SIZE)
+        {
+          if(write(outFd, buffer, filled) != (ssize_t)filled)
+            ret = -1;
+          filled = 0;
+        }
+      }
+      run -= n;
+    }
+  }
+  if(filled > 0 && ret == 0 && write(outFd, buffer, filled) != (ssize_t)filled)
+    ret = -1;
+  free(buffer);
+  // what the chain holds has been copied, but the file is cut short
+  if(ret == 0 && size > 0)
+  {
+    printf("Error: The cluster chain is shorter than the file size.\n");
+    ret = -1;
+  }
+  return ret;
+}
+
+/*
+ * parameters  : The extents of a freshly allocated chain, how many bytes to fill and the
+ *              descriptor to take them from
+ * returns     : 0 on success, -1 if reading or writing failed
+ * description : The reverse of copyExtents(). Each extent is filled with copy_file_range() so
+ *              the data goes straight into the image, falling back to read() and pwrite()
+ *              through one buffer when the kernel can not copy between the two files.
+ */
+int copyIntoExtents(struct Fat32ExtentMap *map, int64_t size, int inFd)
+{
+  int mode = 0;                 // 0 copy_file_range, 1 read + pwrite
+  uint8_t *buffer = NULL;
+  int ret = 0;
+  for(int i = 0; i < map->count && size > 0 && ret == 0; i++)
+  {
+    off_t offset = fat32ClusterOffset(volume, map->extents[i].diskCluster);
+    int64_t run = (int64_t)map->extents[i].count * info->clusterSize;
+    if(run > size)
+      run = size;
+    size -= run;
+    // copy_file_range() goes around the library, so its block cache is told what changes
+    fat32Invalidate(volume, offset, run);
+    while(run > 0)
+    {
+      ssize_t n = -1;
+      if(mode == 0)
+      {
+        n = copy_file_range(inFd, NULL, fat32Descriptor(volume), &offset, run, 0);
+        if(n <= 0)
+        {
+          mode = 1;
+          continue;
+        }
+        fat32CountWrite(volume, n);
+      }
+      else
+      {
+        if(buffer == NULL && posix_memalign((void **)&buffer, 4096, COPY_BUFFER_SIZE) != 0)
+        {
+          buffer = NULL;
+          ret = -1;
+          break;
+        }
+        n = read(inFd, buffer, run < COPY_BUFFER_SIZE ? run : COPY_BUFFER_SIZE);
+        if(n <= 0 || fat32Write(volume, buffer, offset, n) == -1)
+        {
+          ret = -1;
+          break;
+        }
+        offset += n;
+      }
+      run -= n;
+    }
+  }
+  free(buffer);
+  return ret;
+}
+
+/*
+ * parameters  : An extent map, the number of bytes of the file and a descriptor to write to
+ * returns     : 0 on success, -1 if reading or writing failed or the chain ends before the
+ *              file does, -2 if no reads could be issued ahead, in which case nothing was written
+ * description : Copies a file with up to READAHEAD_DEPTH reads in flight while the chunks
+ *              that are done get written out in file order. The whole chain is already known
+ *              from the extent map, so no read waits on a FAT lookup. The reads go through
+ *              io_uring when the kernel has it and through a few reading threads otherwise.
+ */
+int copyReadahead(struct Fat32ExtentMap *map, int64_t size, int outFd)
+{
+  struct Readahead r;
+  memset(&r, 0, sizeof(r));
+  int capacity = 0;
+  for(int i = 0; i < map->count && size > 0; i++)
+  {
+    off_t offset = fat32ClusterOffset(volume, map->extents[i].diskCluster);
+    int64_t run = (int64_t)map->extents[i].count * info->clusterSize;
+    if(run > size)
+      run = size;
+    size -= run;
+    for(; run > 0; run -= READAHEAD_CHUNK, offset += READAHEAD_CHUNK)
+    {
+      if(r.count == capacity)
+      {
+        capacity = capacity ? capacity * 2 : 64;
+        r.chunks = (struct ReadChunk *)realloc(r.chunks, sizeof(struct ReadChunk) * capacity);
+      }
+      r.chunks[r.count].offset = offset;
+      r.chunks[r.count].length = run < READAHEAD_CHUNK ? run : READAHEAD_CHUNK;
+      r.count++;
+    }
+  }
+  if(posix_memalign((void **)&r.buffers, 4096, (size_t)READAHEAD_DEPTH * READAHEAD_CHUNK) != 0)
+  {
+    free(r.chunks);
+    return -2;
+  }
+  int ret = -2;
+#ifdef HAVE_IO_URING
+  ret = readaheadUring(&r, outFd);
+#endif
+  if(ret == -2)
+    ret = readaheadThreads(&r, outFd);
+  free(r.chunks);
+  free(r.buffers);
+  if(ret == 0 && size > 0)
+  {
+    printf("Error: The cluster chain is shorter than the file size.\n");
+    ret = -1;
+  }
+  return ret;
+}
+
+// writes chunks first to last - 1 out of their slots with one writev(). whatever a read left
+// short is read again here, so a failed asynchronous read only costs time. returns -1 on failure
+int readaheadFlush(struct Readahead *r, int first, int last, int outFd)
+{
+  struct iovec iov[READAHEAD_DEPTH];
+  ssize_t total = 0;
+  if(first >= last)
+    return 0;
+  for(int i = first; i < last; i++)
+  {
+    struct ReadChunk *chunk = &r->chunks[i];
+    uint8_t *buffer = r->buffers + (size_t)(i % READAHEAD_DEPTH) * READAHEAD_CHUNK;
+    if(r->state[i % READAHEAD_DEPTH] != 1 &&
+       fat32ReadDirect(volume, buffer, chunk->offset, chunk->length) == -1)
+      return -1;
+    iov[i - first].iov_base = buffer;
+    iov[i - first].iov_len = chunk->length;
+    total += chunk->length;
+  }
+  ssize_t n = writev(outFd, iov, last - first);
+  if(n < 0)
+    return -1;
+  // a short write is finished off one buffer at a time
+  for(int i = 0; n < total && i < last - first; i++)
+  {
+    if((size_t)n >= iov[i].iov_len)
+    {
+      n -= iov[i].iov_len;
+      total -= iov[i].iov_len;
+      continue;
+    }
+    if(writeAll(outFd, (uint8_t *)iov[i].iov_base + n, iov[i].iov_len - n) == -1)
+      return -1;
+    total -= iov[i].iov_len;
+    n = 0;
+  }
+  return 0;
+}
+
+// the fallback pipeline, READAHEAD_THREADS threads pread() chunks while this one writes them.
+// returns -2 if not a single thread could be started
+int readaheadThreads(struct Readahead *r, int outFd)
+{
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->cond, NULL);
+  pthread_t tids[READAHEAD_THREADS];
+  int started = 0;
+  for(; started < READAHEAD_THREADS; started++)
+  {
+    if(pthread_create(&tids[started], NULL, readaheadWorker, r) != 0)
+      break;
+  }
+  int ret = started == 0 ? -2 : 0;
+  while(r->written < r->count && started > 0)
+  {
+    // wait for the oldest chunk, then take every finished chunk right behind it along
+    pthread_mutex_lock(&r->lock);
+    while(r->state[r->written % READAHEAD_DEPTH] == 0)
+      pthread_cond_wait(&r->cond, &r->lock);
+    int last = r->written;
+    while(last < r->next && r->state[last % READAHEAD_DEPTH] != 0)
+      last++;
+    pthread_mutex_unlock(&r->lock);
+    if(readaheadFlush(r, r->written, last, outFd) == -1)
+      ret = -1;
+    pthread_mutex_lock(&r->lock);
+    for(int i = r->written; i < last; i++)
+      r->state[i % READAHEAD_DEPTH] = 0;
+    r->written = last;
+    r->failed = ret == -1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    if(ret == -1)
+      break;
+  }
+  for(int i = 0; i < started; i++)
+    pthread_join(tids[i], NULL);
+  pthread_mutex_destroy(&r->lock);
+  pthread_cond_destroy(&r->cond);
+  return ret;
+}
+
+// thread body of the fallback pipeline, reads the next chunk whenever its slot is free
+void *readaheadWorker(void *arg)
+{
+  struct Readahead *r = arg;
+  pthread_mutex_lock(&r->lock);
+  while(1)
+  {
+    while(!r->failed && r->next < r->count && r->next >= r->written + READAHEAD_DEPTH)
+      pthread_cond_wait(&r->cond, &r->lock);
+    if(r->failed || r->next >= r->count)
+      break;
+    int index = r->next++;
+    pthread_mutex_unlock(&r->lock);
+    struct ReadChunk *chunk = &r->chunks[index];
+    uint8_t *buffer = r->buffers + (size_t)(index % READAHEAD_DEPTH) * READAHEAD_CHUNK;
+    ssize_t n = pread(fat32Descriptor(volume), buffer, chunk->length, chunk->offset);
+    if(n > 0)
+      fat32CountRead(volume, chunk->offset, n);
+    pthread_mutex_lock(&r->lock);
+    r->state[index % READAHEAD_DEPTH] = n == (ssize_t)chunk->length ? 1 : -1;
+    pthread_cond_broadcast(&r->cond);
+  }
+  pthread_mutex_unlock(&r->lock);
+  return NULL;
+}
+
+#ifdef HAVE_IO_URING
+/*
+ * parameters  : The pipeline and the descriptor to write to
+ * returns     : 0 on success, -1 on failure, -2 if io_uring is not available
+ * description : Keeps the submission queue topped up to READAHEAD_DEPTH reads and, whenever
+ *              the oldest unwritten chunk is not read yet, waits for completions in the same
+ *              io_uring_enter() call that submits the next reads.
+ */
+int readaheadUring(struct Readahead *r, int outFd)
+{
+  struct Ring ring;
+  if(ringSetup(&ring, READAHEAD_DEPTH) == -1)
+    return -2;
+  struct iovec iov[READAHEAD_DEPTH];
+  int ret = 0;
+  int unsubmitted = 0;          // reads in the submission queue the kernel has not taken yet
+  int inFlight = 0;             // reads submitted whose completion has not been reaped
+  while(r->written < r->count && ret == 0)
+  {
+    uint32_t tail = *ring.sqTail;
+    int queued = 0;
+    for(; r->next < r->count && r->next < r->written + READAHEAD_DEPTH; r->next++, queued++)
+    {
+      int slot = r->next % READAHEAD_DEPTH;
+      uint32_t index = (tail + queued) & *ring.sqMask;
+      struct io_uring_sqe *sqe = &ring.sqes[index];
+      iov[slot].iov_base = r->buffers + (size_t)slot * READAHEAD_CHUNK;
+      iov[slot].iov_len = r->chunks[r->next].length;
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_READV;
+      sqe->fd = fat32Descriptor(volume);
+      sqe->addr = (uint64_t)(uintptr_t)&iov[slot];
+      sqe->len = 1;
+      sqe->off = r->chunks[r->next].offset;
+      sqe->user_data = r->next;
+      ring.sqArray[index] = index;
+      r->state[slot] = 0;
+    }
+    __atomic_store_n(ring.sqTail, tail + queued, __ATOMIC_RELEASE);
+    unsubmitted += queued;
+    // after a short submit or EINTR the rest is still in the queue and goes with the next call
+    int wait = r->state[r->written % READAHEAD_DEPTH] == 0;
+    long submitted = syscall(__NR_io_uring_enter, ring.fd, unsubmitted, wait,
+                             wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if(submitted < 0 && errno != EINTR)
+    {
+      ret = -1;
+      break;
+    }
+    if(submitted > 0)
+    {
+      unsubmitted -= submitted;
+      inFlight += submitted;
+    }
+    uint32_t head = *ring.cqHead;
+    for(; head != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE); head++, inFlight--)
+    {
+      struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cqMask];
+      int chunk = cqe->user_data;
+      r->state[chunk % READAHEAD_DEPTH] = cqe->res == (int32_t)r->chunks[chunk].length ? 1 : -1;
+      if(cqe->res > 0)
+        fat32CountRead(volume, r->chunks[chunk].offset, cqe->res);
+    }
+    __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+    int last = r->written;
+    while(last < r->next && r->state[last % READAHEAD_DEPTH] != 0)
+      last++;
+    if(last > r->written && readaheadFlush(r, r->written, last, outFd) == -1)
+      ret = -1;
+    else
+      r->written = last;
+  }
+  // reads still in flight point into the buffers, so they have to land before returning. the
+  // ones never submitted go away with the ring
+  while(inFlight > 0)
+  {
+    if(syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+       errno != EINTR)
+      break;
+    uint32_t head = *ring.cqHead;
+    for(; head != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE); head++)
+      inFlight--;
+    __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+  }
+  ringClose(&ring);
+  return ret;
+}
+
+// creates an io_uring and maps its queues, returns -1 if the kernel does not allow it
+int ringSetup(struct Ring *ring, unsigned entries)
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if(ring->fd < 0)
+    return -1;
+  ring->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+  ring->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  // newer kernels put both rings in one mapping
+  if(p.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if(ring->cqRingSize > ring->sqRingSize)
+      ring->sqRingSize = ring->cqRingSize;
+    ring->cqRingSize = 0;
+  }
+  ring->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQ_RING);
+  ring->cqRing = ring->sqRing;
+  if(ring->sqRing != MAP_FAILED && ring->cqRingSize != 0)
+    ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_CQ_RING);
+  ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring->fd, IORING_OFF_SQES);
+  if(ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED)
+  {
+    ringClose(ring);
+    return -1;
+  }
+  uint8_t *sq = ring->sqRing;
+  uint8_t *cq = ring->cqRing;
+  ring->sqHead = (uint32_t *)(sq + p.sq_off.head);
+  ring->sqTail = (uint32_t *)(sq + p.sq_off.tail);
+  ring->sqMask = (uint32_t *)(sq + p.sq_off.ring_mask);
+  ring->sqArray = (uint32_t *)(sq + p.sq_off.array);
+  ring->cqHead = (uint32_t *)(cq + p.cq_off.head);
+  ring->cqTail = (uint32_t *)(cq + p.cq_off.tail);
+  ring->cqMask = (uint32_t *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return 0;
+}
+
+// unmaps the queues of an io_uring and closes it
+void ringClose(struct Ring *ring)
+{
+  if(ring->sqes != NULL && ring->sqes != MAP_FAILED)
+    munmap(ring->sqes, ring->sqesSize);
+  if(ring->cqRing != NULL && ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing)
+    munmap(ring->cqRing, ring->cqRingSize);
+  if(ring->sqRing != NULL && ring->sqRing != MAP_FAILED)
+    munmap(ring->sqRing, ring->sqRingSize);
+  close(ring->fd);
+}
+#endif
+
+void fatRead(char *name, char *pos, char *byt, int raw)
+{
+  if(name == NULL || pos == NULL || byt == NULL)
+  {
+    printf("Error: Usage is read [-b] <filename> <position> <number of bytes>.\n");
+    return;
+  }
+  int index = findString(name);
+  if(index == -1)
+  {
+    printf("Error: File not found.\n");
+    return;
+  }
+  int64_t position = atoll(pos);
+  int64_t bytes = atoll(byt);
+  if(position < 0 || bytes < 0)
+  {
+    printf("Error: Position and number of bytes can not be negative.\n");
+    return;
+  }
+  // never read past the end of the file
+  if(position > cwd->entries[index].DIR_FileSize)
+    position = cwd->entries[index].DIR_FileSize;
+  if(bytes > cwd->entries[index].DIR_FileSize - position)
+    bytes = cwd->entries[index].DIR_FileSize - position;
+  struct Fat32ExtentMap *map = getExtents(fat32EntryCluster(&cwd->entries[index]));
+  // the range, up to a whole 4 GB file, is read and printed a piece at a time. each byte
+  // becomes at most two hex digits and a space
+  uint8_t *buffer = (uint8_t *)malloc(READ_BUFFER_SIZE);
+  char *text = raw ? NULL : (char *)malloc(READ_BUFFER_SIZE * 3);
+  if(buffer == NULL || (!raw && text == NULL))
+  {
+    printf("Error: Out of memory.\n");
+    free(buffer);
+    free(text);
+    return;
+  }
+
+  // anything printf'd so far has to reach stdout before the bulk writes do
+  fflush(stdout);
+  static const char hexDigits[] = "0123456789abcdef";
+  while(bytes > 0)
+  {
+    int64_t n = fat32ExtentRead(volume, map, buffer, position,
+                                bytes < READ_BUFFER_SIZE ? bytes : READ_BUFFER_SIZE);
+    if(n <= 0)
+    {
+      if(!raw)
+        writeAll(STDOUT_FILENO, "\n", 1);
+      printf("Error: Could not read %s.\n", name);
+      free(text);
+      free(buffer);
+      return;
+    }
+    position += n;
+    bytes -= n;
+    if(raw)
+    {
+      writeAll(STDOUT_FILENO, buffer, n);
+      continue;
+    }
+    // the same text "%x " used to give, looked up from a table and written in one call
+    char *out = text;
+    for(int64_t i = 0; i < n; i++)
+    {
+      uint8_t b = buffer[i];
+      if(b > 0x0f)
+        *out++ = hexDigits[b >> 4];
+      *out++ = hexDigits[b & 0x0f];
+      *out++ = ' ';
+    }
+    writeAll(STDOUT_FILENO, text, out - text);
+  }
+  if(!raw)
+    writeAll(STDOUT_FILENO, "\n", 1);
+  free(text);
+  free(buffer);
+}
+
+// writes all len bytes of buf to fd, retrying on short writes. returns 0 or -1 on error
+int writeAll(int fd, const void *buf, size_t len)
+{
+  const uint8_t *p = buf;
+  while(len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if(n == -1 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int cd(char *str)
+{
+  uint32_t cluster;
+  struct Directory *d = NULL;
+  // the current directory is only replaced once the whole path resolved, so a failed cd
+  // leaves it untouched without having to walk back up
+  if(str != NULL && resolvePath(str, &cluster) == 0)
+    d = getDirectory(cluster);
+  if(d == NULL)
+  {
+    printf("Error: Subdirectory not found.\n");
+    return -1;
+  }
+  cwd = d;
+  return 0;
+}
+
+/*
+ * parameters  : A path to a directory and where to store the directory's first cluster
+ * returns     : 0 on success, -1 if some component does not exist or is not a directory
+ * description : Resolves absolute ("/a/b") and relative ("a/../b") paths one component at a
+ *              time starting from the root or the current directory.
+ */
+int resolvePath(const char *path, uint32_t *cluster)
+{
+  uint32_t current = path[0] == '/' || cwd == NULL ? info->BPB_RootClus : cwd->cluster;
+  char component[MAX_COMMAND_SIZE];
+  while(*path != '\0')
+  {
+    while(*path == '/')
+      path++;
+    size_t len = strcspn(path, "/");
+    if(len == 0)
+      break;
+    memcpy(component, path, len);
+    component[len] = '\0';
+    path += len;
+    if(strcmp(component, ".") == 0)
+      continue;
+
+    uint8_t attr;
+    if(lookupComponent(current, component, &current, &attr) == -1 || !(attr & 0x10))
+      return -1;
+    if(current == 0)
+      current = info->BPB_RootClus;
+  }
+  *cluster = current;
+  return 0;
+}
+
+/*
+ * parameters  : The directory to look in, a name and where to store what it resolves to
+ * returns     : 0 on success, -1 if the name does not exist in the directory
+ * description : Checks the dentry cache first. On a miss the directory is fetched from the
+ *              directory cache, searched through its index and the result is remembered.
+ */
+int lookupComponent(uint32_t parent, const char *name, uint32_t *cluster, uint8_t *attr)
+{
+  int node = dentryFind(parent, name);
+  if(node != -1)
+  {
+    dentryTouch(node);
+    *cluster = dentryPool[node].cluster;
+    *attr = dentryPool[node].attr;
+    return 0;
+  }
+  struct Directory *d = getDirectory(parent);
+  int index = findEntry(d, name);
+  if(index == -1)
+    return -1;
+  *cluster = fat32EntryCluster(&d->entries[index]);
+  *attr = d->entries[index].DIR_Attr;
+  dentryInsert(parent, name, *cluster, *attr);
+  return 0;
+}
+
+// hash of a dentry key. names are lower cased by the caller so "FOO" and "foo" share a node
+uint32_t dentryHash(uint32_t parent, const char *name)
+{
+  uint32_t hash = 2166136261u ^ parent;
+  for(; *name != '\0'; name++)
+  {
+    hash ^= (uint8_t)tolower(*name);
+    hash *= 16777619u;
+  }
+  return hash % (DENTRY_CACHE_SIZE * 2);
+}
+
+// returns the dentry node for name inside parent, or -1 if it is not cached
+int dentryFind(uint32_t parent, const char *name)
+{
+  if(dentryUsed == 0)
+    return -1;
+  for(int node = dentryBuckets[dentryHash(parent, name)]; node != -1;
+      node = dentryPool[node].hashNext)
+  {
+    if(dentryPool[node].parent == parent && strcasecmp(dentryPool[node].name, name) == 0)
+      return node;
+  }
+  return -1;
+}
+
+// moves a node to the front of the LRU list
+void dentryTouch(int node)
+{
+  struct Dentry *e = &dentryPool[node];
+  if(dentryHead == node)
+    return;
+  if(e->prev != -1)
+    dentryPool[e->prev].next = e->next;
+  if(e->next != -1)
+    dentryPool[e->next].prev = e->prev;
+  if(dentryTail == node)
+    dentryTail = e->prev;
+  e->prev = -1;
+  e->next = dentryHead;
+  if(dentryHead != -1)
+    dentryPool[dentryHead].prev = node;
+  dentryHead = node;
+  if(dentryTail == -1)
+    dentryTail = node;
+}
+
+/*
+ * parameters  : The key (parent cluster and name) and what it resolved to
+ * description : Remembers a resolved component. Once all DENTRY_CACHE_SIZE nodes are in use
+ *              the least recently used one is unlinked from its bucket and reused.
+ */
+void dentryInsert(uint32_t parent, const char *name, uint32_t cluster, uint8_t attr)
+{
+  if(dentryUsed == 0)
+    memset(dentryBuckets, -1, sizeof(dentryBuckets));
+  int node;
+  if(dentryUsed < DENTRY_CACHE_SIZE)
+  {
+    node = dentryUsed++;
+    dentryPool[node].prev = -1;
+    dentryPool[node].next = -1;
+  }
+  else
+  {
+    node = dentryTail;
+    struct Dentry *old = &dentryPool[node];
+    int *link = &dentryBuckets[dentryHash(old->parent, old->name)];
+    while(*link != node)
+      link = &dentryPool[*link].hashNext;
+    *link = old->hashNext;
+    free(old->name);
+  }
+  struct Dentry *e = &dentryPool[node];
+  e->parent = parent;
+  e->name = strdup(name);
+  e->cluster = cluster;
+  e->attr = attr;
+  uint32_t bucket = dentryHash(parent, name);
+  e->hashNext = dentryBuckets[bucket];
+  dentryBuckets[bucket] = node;
+  dentryTouch(node);
+}
+
+// forgets every resolved component
+void dentryClear()
+{
+  for(int i = 0; i < dentryUsed; i++)
+    free(dentryPool[i].name);
+  memset(dentryPool, 0, sizeof(dentryPool));
+  dentryUsed = 0;
+  dentryHead = -1;
+  dentryTail = -1;
+}
+
+/*
+ * parameters  : The first cluster of a file
+ * returns     : The extent map of the file's cluster chain
+ * description : Walks the chain once and collapses clusters that follow each other on disk into
+ *              a single extent. Maps are cached by first cluster so opening the same file again
+ *              costs nothing. A first cluster of 0 (empty file) gives a map without extents.
+ */
+struct Fat32ExtentMap *getExtents(uint32_t firstCluster)
+{
+  struct Fat32ExtentMap *map = &extentCache[firstCluster % EXTENT_CACHE_SIZE];
+  if(map->firstCluster == firstCluster && map->extents != NULL)
+    return map;
+  free(map->extents);
+  fat32BuildExtents(volume, firstCluster, map);
+  return map;
+}
+
+// releases every cached extent map
+void extentCacheFree()
+{
+  for(int i = 0; i < EXTENT_CACHE_SIZE; i++)
+  {
+    free(extentCache[i].extents);
+    memset(&extentCache[i], 0, sizeof(struct Fat32ExtentMap));
+  }
+}
+
+// releases the free cluster bitmap
+void fatFree()
+{
+  free(freeMap);
+  freeMap = NULL;
+  freeClusters = 0;
+}
+
+/*
+ * returns     : 0 on success, -1 if a write failed
+ * description : Has the library write the changed FAT entries to every FAT copy and brings the
+ *              FSInfo hints up to date once the allocator has counted the free clusters.
+ */
+int fatFlush()
+{
+  int ret = fat32Flush(volume);
+  uint32_t oldFree;
+  uint32_t oldNext;
+  if(freeMap != NULL && fat32ReadFSInfo(volume, &oldFree, &oldNext) == 0 &&
+     fat32WriteFSInfo(volume, freeClusters, nextFreeHint) == -1)
+    ret = -1;
+  return ret;
+}
+
+/*
+ * returns     : 0 on success, -1 if the FAT could not be read
+ * description : Builds the free cluster bitmap the first time something is allocated or freed.
+ *              The count comes from the FAT itself, FSInfo only provides the starting hint
+ *              since its free count may well be stale.
+ */
+int freeMapLoad()
+{
+  if(freeMap != NULL)
+    return 0;
+  freeMap = (uint64_t *)calloc(((uint64_t)info->clusterCount + 2 + 63) / 64, sizeof(uint64_t));
+  if(freeMap == NULL)
+    return -1;
+  freeClusters = 0;
+  for(uint32_t c = 2; c < info->clusterCount + 2; c++)
+  {
+    if(fat32Entry(volume, c) == 0)
+    {
+      freeMap[c / 64] |= 1ULL << (c % 64);
+      freeClusters++;
+    }
+  }
+  uint32_t count;
+  uint32_t hint;
+  nextFreeHint = 2;
+  if(fat32ReadFSInfo(volume, &count, &hint) == 0 && hint >= 2 && hint < info->clusterCount + 2)
+    nextFreeHint = hint;
+  return 0;
+}
+
+// returns the first free cluster in [from, end), or end if there is none. whole words of used
+// clusters are skipped at once
+uint32_t nextFreeCluster(uint32_t from, uint32_t end)
+{
+  while(from < end)
+  {
+    uint64_t word = freeMap[from / 64] >> (from % 64);
+    if(word != 0)
+    {
+      from += __builtin_ctzll(word);
+      return from < end ? from : end;
+    }
+    from = (from / 64 + 1) * 64;
+  }
+  return end;
+}
+
+// returns the first used cluster in [from, end), or end if there is none
+uint32_t nextUsedCluster(uint32_t from, uint32_t end)
+{
+  while(from < end)
+  {
+    uint64_t word = ~freeMap[from / 64] >> (from % 64);
+    if(word != 0)
+    {
+      from += __builtin_ctzll(word);
+      return from < end ? from : end;
+    }
+    from = (from / 64 + 1) * 64;
+  }
+  return end;
+}
+
+/*
+ * parameters  : How many clusters are needed and where to store their numbers
+ * returns     : 0 on success, -1 if there are not enough free clusters
+ * description : Takes clusters out of the free bitmap and links them into a chain in the in
+ *              memory FAT. A single run of free clusters big enough for all of them is used if
+ *              one exists, searching from the next free hint and then from the start of the
+ *              volume. Otherwise the free clusters are taken in order from the hint, which
+ *              still keeps whatever runs there are together.
+ */
+int allocClusters(uint32_t count, uint32_t *clusters)
+{
+  if(count == 0)
+    return 0;
+  if(freeMapLoad() == -1 || count > freeClusters)
+    return -1;
+  uint32_t end = info->clusterCount + 2;
+  uint32_t start = 0;
+  for(int pass = 0; pass < 2 && start == 0; pass++)
+  {
+    uint32_t c = pass == 0 ? nextFreeHint : 2;
+    uint32_t stop = pass == 0 ? end : nextFreeHint;
+    while((c = nextFreeCluster(c, stop)) < stop)
+    {
+      uint32_t used = nextUsedCluster(c, end);
+      if(used - c >= count)
+      {
+        start = c;
+        break;
+      }
+      c = used;
+    }
+  }
+  if(start != 0)
+  {
+    for(uint32_t i = 0; i < count; i++)
+      clusters[i] = start + i;
+  }
+  else
+  {
+    uint32_t c = nextFreeHint;
+    for(uint32_t i = 0; i < count; i++)
+    {
+      c = nextFreeCluster(c, end);
+      if(c == end)
+        c = nextFreeCluster(2, end);
+      clusters[i] = c++;
+    }
+  }
+  for(uint32_t i = 0; i < count; i++)
+  {
+    freeMap[clusters[i] / 64] &= ~(1ULL << (clusters[i] % 64));
+    fat32SetEntry(volume, clusters[i], i + 1 < count ? clusters[i + 1] : FAT32_END_OF_CHAIN);
+  }
+  freeClusters -= count;
+  nextFreeHint = clusters[count - 1] + 1 < end ? clusters[count - 1] + 1 : 2;
+  return 0;
+}
+
+/*
+ * parameters  : 1 to answer from the FSInfo sector alone when it holds a valid free count
+ * description : Prints how the data clusters are used. The whole FAT is scanned to count free,
+ *              used, bad and end of chain entries and the free count is checked against the
+ *              one FSInfo keeps.
+ */
+void fatDf(int quick)
+{
+  uint32_t hint;
+  uint32_t nextFree;
+  int valid = fat32ReadFSInfo(volume, &hint, &nextFree) == 0 && hint != FAT32_FSINFO_UNKNOWN &&
+              hint <= info->clusterCount;
+  uint64_t total = (uint64_t)info->clusterCount * info->clusterSize;
+  printf("Clusters:\t %u\t %llu bytes\n", info->clusterCount, (unsigned long long)total);
+  if(quick && valid)
+  {
+    printf("Free:\t\t %u\t %llu bytes (FSInfo)\n", hint,
+           (unsigned long long)hint * info->clusterSize);
+    printf("Used:\t\t %u\t %llu bytes (FSInfo)\n", info->clusterCount - hint,
+           (unsigned long long)(info->clusterCount - hint) * info->clusterSize);
+    return;
+  }
+
+  // counts[0] free, counts[1] bad, counts[2] end of chain
+  uint64_t counts[3] = { 0, 0, 0 };
+  if(countFat(2, info->clusterCount, counts) == -1)
+  {
+    printf("Error: Could not read the FAT.\n");
+    return;
+  }
+  uint64_t used = info->clusterCount - counts[0] - counts[1];
+  printf("Free:\t\t %llu\t %llu bytes\n", (unsigned long long)counts[0],
+         (unsigned long long)counts[0] * info->clusterSize);
+  printf("Used:\t\t %llu\t %llu bytes\n", (unsigned long long)used,
+         (unsigned long long)used * info->clusterSize);
+  printf("Bad:\t\t %llu\n", (unsigned long long)counts[1]);
+  printf("Chain ends:\t %llu\n", (unsigned long long)counts[2]);
+  if(!valid)
+    printf("FSInfo free:\t not set\n");
+  else if(hint == counts[0])
+    printf("FSInfo free:\t %u\t matches\n", hint);
+  else
+    printf("FSInfo free:\t %u\t differs by %lld\n", hint, (long long)hint - (long long)counts[0]);
+}
+
+// prints the counters of the library's block cache, then zeroes them if reset is set
+void fatCacheStats(int reset)
+{
+  struct Fat32CacheStats stats;
+  fat32GetCacheStats(volume, &stats);
+  uint64_t lookups = stats.hits + stats.misses;
+  printf("Frames:\t\t %u of %u used, %u bytes each\n", stats.used, stats.frames, stats.frameSize);
+  printf("Budget:\t\t %llu bytes\n", (unsigned long long)stats.frames * stats.frameSize);
+  printf("Hits:\t\t %llu\n", (unsigned long long)stats.hits);
+  printf("Misses:\t\t %llu\n", (unsigned long long)stats.misses);
+  printf("Evictions:\t %llu\n", (unsigned long long)stats.evictions);
+  printf("Hit rate:\t %.1f%%\n", lookups ? 100.0 * stats.hits / lookups : 0.0);
+  if(reset)
+    fat32ResetCacheStats(volume);
+}
+
+// sets the memory budget of the block cache, in bytes with an optional K, M or G suffix. 0
+// turns the cache off. whatever was cached is dropped
+void fatCacheSize(char *size)
+{
+  char *end;
+  if(size == NULL)
+  {
+    printf("Error: Usage is cachesize <bytes>[K|M|G].\n");
+    return;
+  }
+  unsigned long long bytes = strtoull(size, &end, 10);
+  int shift = toupper(*end) == 'K' ? 10 : toupper(*end) == 'M' ? 20 : toupper(*end) == 'G' ? 30 : 0;
+  if(end == size || (shift && end[1] != '\0') || (!shift && *end != '\0') ||
+     bytes > (SIZE_MAX >> shift))
+  {
+    printf("Error: Usage is cachesize <bytes>[K|M|G].\n");
+    return;
+  }
+  if(fat32SetCacheSize(volume, (size_t)(bytes << shift)) == -1)
+    printf("Error: Not enough memory for a cache of %s.\n", size);
+}
+
+// counts free, bad and end of chain entries in plain C, entries are masked to 28 bits first
+void countFatScalar(const uint32_t *fat, uint32_t count, uint64_t *counts)
+{
+  for(uint32_t i = 0; i < count; i++)
+  {
+    uint32_t v = fat[i] & FAT32_ENTRY_MASK;
+    counts[0] += v == 0;
+    counts[1] += v == FAT32_BAD_CLUSTER;
+    counts[2] += v > FAT32_BAD_CLUSTER;
+  }
+}
+
+#ifdef __SSE2__
+// SSE2 version of countFatScalar(), four entries per step. every compare gives -1 in the
+// lanes that match, so subtracting it from an accumulator counts the matches. masked entries
+// fit in 28 bits which makes the signed compare safe
+void countFatSse2(const uint32_t *fat, uint32_t count, uint64_t *counts)
+{
+  const __m128i mask = _mm_set1_epi32(FAT32_ENTRY_MASK);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bad = _mm_set1_epi32(FAT32_BAD_CLUSTER);
+  __m128i freeAcc = zero;
+  __m128i badAcc = zero;
+  __m128i endAcc = zero;
+  uint32_t i = 0;
+  for(; i + 4 <= count; i += 4)
+  {
+    __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(fat + i)), mask);
+    freeAcc = _mm_sub_epi32(freeAcc, _mm_cmpeq_epi32(v, zero));
+    badAcc = _mm_sub_epi32(badAcc, _mm_cmpeq_epi32(v, bad));
+    endAcc = _mm_sub_epi32(endAcc, _mm_cmpgt_epi32(v, bad));
+  }
+  uint32_t lanes[4];
+  _mm_storeu_si128((__m128i *)lanes, freeAcc);
+  counts[0] += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  _mm_storeu_si128((__m128i *)lanes, badAcc);
+  counts[1] += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  _mm_storeu_si128((__m128i *)lanes, endAcc);
+  counts[2] += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  countFatScalar(fat + i, count - i, counts);
+}
+
+// AVX2 version of countFatSse2(), eight entries per step. only used when the CPU has it
+__attribute__((target("avx2")))
+void countFatAvx2(const uint32_t *fat, uint32_t count, uint64_t *counts)
+{
+  const __m256i mask = _mm256_set1_epi32(FAT32_ENTRY_MASK);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i bad = _mm256_set1_epi32(FAT32_BAD_CLUSTER);
+  __m256i freeAcc = zero;
+  __m256i badAcc = zero;
+  __m256i endAcc = zero;
+  uint32_t i = 0;
+  for(; i + 8 <= count; i += 8)
+  {
+    __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(fat + i)), mask);
+    freeAcc = _mm256_sub_epi32(freeAcc, _mm256_cmpeq_epi32(v, zero));
+    badAcc = _mm256_sub_epi32(badAcc, _mm256_cmpeq_epi32(v, bad));
+    endAcc = _mm256_sub_epi32(endAcc, _mm256_cmpgt_epi32(v, bad));
+  }
+  uint32_t lanes[8];
+  __m256i *accs[3] = { &freeAcc, &badAcc, &endAcc };
+  for(int a = 0; a < 3; a++)
+  {
+    _mm256_storeu_si256((__m256i *)lanes, *accs[a]);
+    for(int l = 0; l < 8; l++)
+      counts[a] += lanes[l];
+  }
+  countFatScalar(fat + i, count - i, counts);
+}
+#endif
+
+/*
+ * parameters  : The first cluster to look at, how many clusters and the three counters
+ * returns     : 0 on success, -1 if the FAT could not all be read, the counts are then partial
+ * description : Reads FAT entries out of the image a chunk at a time, which also keeps a 32 bit
+ *              lane counter from ever overflowing, and counts them with AVX2 or SSE2 when
+ *              available.
+ */
+int countFat(uint32_t first, uint32_t count, uint64_t *counts)
+{
+  uint32_t *fat = (uint32_t *)malloc(sizeof(uint32_t) * FAT_CHUNK_ENTRIES);
+  if(fat == NULL)
+    return -1;
+#ifdef __SSE2__
+  int avx2 = __builtin_cpu_supports("avx2");
+#endif
+  while(count > 0)
+  {
+    uint32_t n = count < FAT_CHUNK_ENTRIES ? count : FAT_CHUNK_ENTRIES;
+    if(fat32ReadDirect(volume, fat, info->fatStart + (off_t)first * 4, (size_t)n * 4) == -1)
+    {
+      free(fat);
+      return -1;
+    }
+#ifdef __SSE2__
+    if(avx2)
+      countFatAvx2(fat, n, counts);
+    else
+      countFatSse2(fat, n, counts);
+#else
+    countFatScalar(fat, n, counts);
+#endif
+    first += n;
+    count -= n;
+  }
+  free(fat);
+  return 0;
+}
+
+// round constants of SHA-256
+const uint32_t sha256K[64] =
+{
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+uint32_t crc32cTable[256];      // byte at a time table of crc32cScalar()
+
+#ifdef __SSE2__
+// CRC32C with the SSE4.2 crc32 instruction, eight bytes per step
+__attribute__((target("sse4.2")))
+uint32_t crc32cSse42(uint32_t crc, const uint8_t *data, size_t len)
+{
+  uint64_t c = crc;
+  for(; len >= 8; len -= 8, data += 8)
+  {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    c = _mm_crc32_u64(c, word);
+  }
+  crc = c;
+  for(; len > 0; len--)
+    crc = _mm_crc32_u8(crc, *data++);
+  return crc;
+}
+
+/*
+ * parameters  : The eight state words, the data and how many 64 byte blocks it holds
+ * description : SHA-256 with the SHA extensions. The state is kept as the ABEF and CDGH halves
+ *              sha256rnds2 works on, each instruction does two rounds, and sha256msg1/msg2
+ *              extend the message schedule four words at a time.
+ */
+__attribute__((target("sha,sse4.1")))
+void sha256BlocksNi(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+  const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+  __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+  for(; blocks > 0; blocks--, data += 64)
+  {
+    __m128i abef = state0;
+    __m128i cdgh = state1;
+    __m128i m[4];
+    for(int g = 0; g < 16; g++)
+    {
+      if(g < 4)
+        m[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + g * 16)), swap);
+      else
+      {
+        // W[t] = s1(W[t-2]) + W[t-7] + s0(W[t-15]) + W[t-16], m[g % 4] still holds W[t-16]
+        __m128i w = _mm_sha256msg1_epu32(m[g % 4], m[(g + 1) % 4]);
+        w = _mm_add_epi32(w, _mm_alignr_epi8(m[(g + 3) % 4], m[(g + 2) % 4], 4));
+        m[g % 4] = _mm_sha256msg2_epu32(w, m[(g + 3) % 4]);
+      }
+      __m128i k = _mm_add_epi32(m[g % 4], _mm_loadu_si128((const __m128i *)&sha256K[g * 4]));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, k);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(k, 0x0E));
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+  tmp = _mm_shuffle_epi32(state0, 0x1B);
+  state1 = _mm_shuffle_epi32(state1, 0xB1);
+  _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+  _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+#endif
+
+// picks the checksum code for this CPU the first time sum runs
+void hashInit()
+{
+  if(crc32c != NULL)
+    return;
+  for(uint32_t i = 0; i < 256; i++)
+  {
+    uint32_t c = i;
+    for(int bit = 0; bit < 8; bit++)
+      c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+    crc32cTable[i] = c;
+  }
+  crc32c = crc32cScalar;
+  sha256Blocks = sha256BlocksScalar;
+#ifdef __SSE2__
+  unsigned a, b, c, d;
+  if(__builtin_cpu_supports("sse4.2"))
+    crc32c = crc32cSse42;
+  // SHA-NI is leaf 7 of cpuid, older compilers do not know it by name
+  if(__builtin_cpu_supports("sse4.1") && __get_cpuid_count(7, 0, &a, &b, &c, &d) &&
+     (b & bit_SHA))
+    sha256Blocks = sha256BlocksNi;
+#endif
+}
+
+// CRC32C (the Castagnoli polynomial) a byte at a time. crc is kept inverted between calls
+uint32_t crc32cScalar(uint32_t crc, const uint8_t *data, size_t len)
+{
+  for(; len > 0; len--)
+    crc = crc32cTable[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+void sha256Init(struct Sha256 *h)
+{
+  static const uint32_t initial[8] =
+  {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  memcpy(h->state, initial, sizeof(initial));
+  h->used = 0;
+  h->length = 0;
+}
+
+// feeds data into the hash, whole blocks straight from data and the rest through h->block
+void sha256Update(struct Sha256 *h, const uint8_t *data, size_t len)
+{
+  h->length += len;
+  if(h->used > 0)
+  {
+    size_t n = 64 - h->used < len ? 64 - h->used : len;
+    memcpy(h->block + h->used, data, n);
+    h->used += n;
+    data += n;
+    len -= n;
+    if(h->used < 64)
+      return;
+    sha256Blocks(h->state, h->block, 1);
+    h->used = 0;
+  }
+  if(len >= 64)
+  {
+    sha256Blocks(h->state, data, len / 64);
+    data += len / 64 * 64;
+    len %= 64;
+  }
+  memcpy(h->block, data, len);
+  h->used = len;
+}
+
+// pads the message out and writes the 32 byte digest
+void sha256Final(struct Sha256 *h, uint8_t *digest)
+{
+  uint64_t bits = h->length * 8;
+  uint8_t pad[72];
+  size_t padLength = (h->used < 56 ? 56 : 120) - h->used;
+  memset(pad, 0, sizeof(pad));
+  pad[0] = 0x80;
+  for(int i = 0; i < 8; i++)
+    pad[padLength + i] = bits >> (56 - i * 8);
+  sha256Update(h, pad, padLength + 8);
+  for(int i = 0; i < 8; i++)
+  {
+    digest[i * 4] = h->state[i] >> 24;
+    digest[i * 4 + 1] = h->state[i] >> 16;
+    digest[i * 4 + 2] = h->state[i] >> 8;
+    digest[i * 4 + 3] = h->state[i];
+  }
+}
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// SHA-256 in plain C, for CPUs without the SHA extensions
+void sha256BlocksScalar(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+  for(; blocks > 0; blocks--, data += 64)
+  {
+    uint32_t w[64];
+    for(int t = 0; t < 16; t++)
+      w[t] = (uint32_t)data[t * 4] << 24 | data[t * 4 + 1] << 16 | data[t * 4 + 2] << 8 |
+             data[t * 4 + 3];
+    for(int t = 16; t < 64; t++)
+    {
+      uint32_t s0 = ROTR(w[t - 15], 7) ^ ROTR(w[t - 15], 18) ^ (w[t - 15] >> 3);
+      uint32_t s1 = ROTR(w[t - 2], 17) ^ ROTR(w[t - 2], 19) ^ (w[t - 2] >> 10);
+      w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for(int t = 0; t < 64; t++)
+    {
+      uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) +
+                    sha256K[t] + w[t];
+      uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+/*
+ * parameters  : A glob pattern
+ * description : Prints the path of every file and directory on the volume whose long name or
+ *              8.3 name matches the pattern, ignoring case. Each thread has its own deque of
+ *              directories to search and steals from the others once it runs dry. Results
+ *              are printed the moment they are found, so their order varies from run to run.
+ */
+void fatFind(char *pattern)
+{
+  struct Find f;
+  memset(&f, 0, sizeof(f));
+  f.pattern = pattern;
+  f.visited = (uint64_t *)calloc(((uint64_t)info->clusterCount + 2 + 63) / 64, sizeof(uint64_t));
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  f.threads = cpus < 1 ? 1 : cpus > MAX_THREADS ? MAX_THREADS : cpus;
+  for(int i = 0; i < f.threads; i++)
+    pthread_mutex_init(&f.deques[i].lock, NULL);
+  pthread_mutex_init(&f.lock, NULL);
+  pthread_cond_init(&f.wake, NULL);
+
+  struct DirJob root = { info->BPB_RootClus, strdup("") };
+  if(info->BPB_RootClus < info->clusterCount + 2)
+    f.visited[info->BPB_RootClus / 64] |= 1ULL << (info->BPB_RootClus % 64);
+  f.pending = 1;
+  findPush(&f.deques[0], &root);
+
+  struct FindWorker workers[MAX_THREADS];
+  pthread_t tids[MAX_THREADS];
+  int started = 0;
+  for(; started < f.threads; started++)
+  {
+    workers[started].find = &f;
+    workers[started].id = started;
+    if(pthread_create(&tids[started], NULL, findWorker, &workers[started]) != 0)
+      break;
+  }
+  // whatever could not get a thread is still stolen from by the ones that did
+  if(started == 0)
+  {
+    workers[0].find = &f;
+    workers[0].id = 0;
+    findWorker(&workers[0]);
+  }
+  for(int i = 0; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  for(int i = 0; i < f.threads; i++)
+  {
+    free(f.deques[i].jobs);
+    pthread_mutex_destroy(&f.deques[i].lock);
+  }
+  pthread_mutex_destroy(&f.lock);
+  pthread_cond_destroy(&f.wake);
+  free(f.visited);
+}
+
+// thread body for find, searches directories until none are left anywhere. a thread with
+// nothing to take sleeps until more directories are queued or the last one is done, so a tree
+// that is one long chain of directories does not keep every core spinning
+void *findWorker(void *arg)
+{
+  struct FindWorker *w = arg;
+  struct Find *f = w->find;
+  struct DirJob job;
+  while(1)
+  {
+    if(findTake(f, w->id, &job))
+    {
+      findSearchDir(f, w->id, &job);
+      free(job.path);
+      if(__atomic_sub_fetch(&f->pending, 1, __ATOMIC_ACQ_REL) == 0)
+        findWake(f);
+      continue;
+    }
+    // checking for work and going to sleep both happen under f->lock, and findWake() takes it
+    // too, so a push can not slip in between and be missed
+    pthread_mutex_lock(&f->lock);
+    while(__atomic_load_n(&f->pending, __ATOMIC_ACQUIRE) != 0 && !findHasWork(f))
+    {
+      f->sleepers++;
+      pthread_cond_wait(&f->wake, &f->lock);
+      f->sleepers--;
+    }
+    int done = __atomic_load_n(&f->pending, __ATOMIC_ACQUIRE) == 0;
+    pthread_mutex_unlock(&f->lock);
+    if(done)
+      break;
+  }
+  return NULL;
+}
+
+// returns 1 if any deque holds a directory
+int findHasWork(struct Find *f)
+{
+  int found = 0;
+  for(int i = 0; i < f->threads && !found; i++)
+  {
+    pthread_mutex_lock(&f->deques[i].lock);
+    found = f->deques[i].tail > f->deques[i].head;
+    pthread_mutex_unlock(&f->deques[i].lock);
+  }
+  return found;
+}
+
+// wakes the sleeping find threads, after directories were queued or the last one finished
+void findWake(struct Find *f)
+{
+  pthread_mutex_lock(&f->lock);
+  if(f->sleepers > 0)
+    pthread_cond_broadcast(&f->wake);
+  pthread_mutex_unlock(&f->lock);
+}
+
+// matches every entry of one directory against the pattern and queues its subdirectories
+void findSearchDir(struct Find *f, int id, struct DirJob *job)
+{
+  struct Directory d;
+  memset(&d, 0, sizeof(d));
+  if(loadDirectory(&d, job->cluster) == -1)
+  {
+    dirRelease(&d);
+    return;
+  }
+  struct DirJob *children = NULL;
+  int childCount = 0;
+  for(int i = 0; i < d.count; i++)
+  {
+    struct Fat32DirEntry *e = &d.entries[i];
+    if(!fat32IsVisible(e) || e->DIR_Name[0] == '.')
+      continue;
+    char buffer[13];
+    const char *name = hostName(&d, i, buffer);
+    int match = fnmatch(f->pattern, name, FNM_CASEFOLD) == 0 ||
+                (d.longNames[i] != NULL &&
+                 fnmatch(f->pattern, fat32ShortName(e->DIR_Name, buffer), FNM_CASEFOLD) == 0);
+    char *path = NULL;
+    if(match || (e->DIR_Attr & 0x10))
+    {
+      path = (char *)malloc(strlen(job->path) + strlen(name) + 2);
+      sprintf(path, "%s/%s", job->path, name);
+    }
+    if(match)
+      printf("%s\n", path);
+    uint32_t cluster = fat32EntryCluster(e);
+    // a directory is only queued the first time its cluster comes up, which keeps one that
+    // links back to a parent from being searched forever
+    if((e->DIR_Attr & 0x10) && cluster >= 2 && cluster < info->clusterCount + 2 &&
+       !(__atomic_fetch_or(&f->visited[cluster / 64], 1ULL << (cluster % 64), __ATOMIC_RELAXED) &
+         (1ULL << (cluster % 64))))
+    {
+      children = (struct DirJob *)realloc(children, sizeof(struct DirJob) * (childCount + 1));
+      children[childCount].cluster = cluster;
+      children[childCount].path = path;
+      childCount++;
+      continue;
+    }
+    free(path);
+  }
+  dirRelease(&d);
+
+  // the subdirectories are prefetched in disk order and pushed so that this thread pops them
+  // in that order too
+  qsort(children, childCount, sizeof(struct DirJob), compareDirJobs);
+  prefetchDirs(children, childCount);
+  __atomic_add_fetch(&f->pending, childCount, __ATOMIC_ACQ_REL);
+  for(int i = childCount - 1; i >= 0; i--)
+    findPush(&f->deques[id], &children[i]);
+  if(childCount > 0)
+    findWake(f);
+  free(children);
+}
+
+// adds a directory to the tail of a deque
+void findPush(struct FindDeque *q, struct DirJob *job)
+{
+  pthread_mutex_lock(&q->lock);
+  if(q->tail == q->capacity)
+  {
+    // slide what is left down to the front before growing
+    memmove(q->jobs, q->jobs + q->head, sizeof(struct DirJob) * (q->tail - q->head));
+    q->tail -= q->head;
+    q->head = 0;
+    if(q->tail == q->capacity)
+    {
+      q->capacity = q->capacity ? q->capacity * 2 : 64;
+      q->jobs = (struct DirJob *)realloc(q->jobs, sizeof(struct DirJob) * q->capacity);
+    }
+  }
+  q->jobs[q->tail++] = *job;
+  pthread_mutex_unlock(&q->lock);
+}
+
+// takes the newest directory of the thread's own deque, or the oldest one of another thread's.
+// returns 1 if a directory was found
+int findTake(struct Find *f, int id, struct DirJob *job)
+{
+  struct FindDeque *own = &f->deques[id];
+  pthread_mutex_lock(&own->lock);
+  int found = own->tail > own->head;
+  if(found)
+    *job = own->jobs[--own->tail];
+  pthread_mutex_unlock(&own->lock);
+  for(int i = 1; i < f->threads && !found; i++)
+  {
+    struct FindDeque *victim = &f->deques[(id + i) % f->threads];
+    pthread_mutex_lock(&victim->lock);
+    found = victim->tail > victim->head;
+    if(found)
+      *job = victim->jobs[victim->head++];
+    pthread_mutex_unlock(&victim->lock);
+  }
+  return found;
+}
+
+// asks the kernel to start reading the first cluster of each directory, which have to be
+// sorted by cluster. neighbouring clusters are merged into one request
+void prefetchDirs(struct DirJob *jobs, int count)
+{
+  for(int i = 0; i < count;)
+  {
+    int j = i + 1;
+    while(j < count && jobs[j].cluster <= jobs[j - 1].cluster + 1)
+      j++;
+    off_t start = fat32ClusterOffset(volume, jobs[i].cluster);
+    off_t end = fat32ClusterOffset(volume, jobs[j - 1].cluster) + info->clusterSize;
+    posix_fadvise(fat32Descriptor(volume), start, end - start, POSIX_FADV_WILLNEED);
+    i = j;
+  }
+}
+
+// qsort comparison ordering directories by their first cluster
+int compareDirJobs(const void *a, const void *b)
+{
+  uint32_t x = ((const struct DirJob *)a)->cluster;
+  uint32_t y = ((const struct DirJob *)b)->cluster;
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * description : Checks the whole volume and prints every problem as an "Error:" line. Worker
+ *              threads take directories off a shared queue and follow the chain of every entry
+ *              in them, claiming each cluster in a bitmap with an atomic test and set. A cluster
+ *              that is already claimed is either a loop in the chain or a cross link. Chains
+ *              that are too short or too long for the file size are reported as well. Once
+ *              every directory is done, allocated clusters nobody claimed are counted as lost
+ *              chains and the FAT copies are compared against the first one.
+ */
+void fatFsck()
+{
+  struct Fsck f;
+  memset(&f, 0, sizeof(f));
+  uint64_t words = ((uint64_t)info->clusterCount + 2 + 63) / 64;
+  f.owned = (uint64_t *)calloc(words, sizeof(uint64_t));
+  pthread_mutex_init(&f.lock, NULL);
+  pthread_cond_init(&f.wake, NULL);
+
+  if(fsckClaimChain(&f, info->BPB_RootClus, "/") >= 0)
+    fsckQueue(&f, info->BPB_RootClus, strdup(""));
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int threads = cpus < 1 ? 1 : cpus > MAX_THREADS ? MAX_THREADS : cpus;
+  pthread_t tids[MAX_THREADS];
+  int started = 0;
+  for(; started < threads; started++)
+  {
+    if(pthread_create(&tids[started], NULL, fsckWorker, &f) != 0)
+      break;
+  }
+  if(started == 0)
+    fsckWorker(&f);
+  for(int i = 0; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  // an allocated cluster no chain claimed is lost. a lost cluster that no other lost cluster
+  // points at starts a lost chain
+  uint64_t *pointed = (uint64_t *)calloc(words, sizeof(uint64_t));
+  uint64_t lostClusters = 0;
+  uint64_t lostChains = 0;
+  for(int pass = 0; pass < 2; pass++)
+  {
+    for(uint32_t c = 2; c < info->clusterCount + 2; c++)
+    {
+      uint32_t next = fat32Entry(volume, c);
+      if(next == 0 || next == FAT32_BAD_CLUSTER || (f.owned[c / 64] >> (c % 64)) & 1)
+        continue;
+      if(pass == 0 && next >= 2 && next < info->clusterCount + 2)
+        pointed[next / 64] |= 1ULL << (next % 64);
+      if(pass == 1)
+      {
+        lostClusters++;
+        lostChains += !((pointed[c / 64] >> (c % 64)) & 1);
+      }
+    }
+  }
+  if(lostClusters)
+    fsckProblem(&f, "Error: %llu lost chains holding %llu clusters.", (unsigned long long)lostChains,
+                (unsigned long long)lostClusters);
+  for(int copy = 1; copy < info->BPB_NumFATs; copy++)
+  {
+    uint64_t differ = fsckCompareFats(copy);
+    if(differ)
+      fsckProblem(&f, "Error: FAT %d differs from FAT 1 in %llu entries.", copy + 1,
+                  (unsigned long long)differ);
+  }
+
+  qsort(f.problems, f.problemCount, sizeof(char *), compareStrings);
+  for(int i = 0; i < f.problemCount; i++)
+  {
+    printf("%s\n", f.problems[i]);
+    free(f.problems[i]);
+  }
+  printf("Directories:\t %llu\nFiles:\t\t %llu\nClusters used:\t %llu\n",
+         (unsigned long long)f.dirs, (unsigned long long)f.files, (unsigned long long)f.clusters);
+  if(f.problemCount == 0)
+    printf("No problems found.\n");
+  free(f.problems);
+  free(f.queue);
+  free(f.owned);
+  free(pointed);
+  pthread_mutex_destroy(&f.lock);
+  pthread_cond_destroy(&f.wake);
+}
+
+// thread body for fsck, checks directories until the queue is empty and nobody can add more
+void *fsckWorker(void *arg)
+{
+  struct Fsck *f = arg;
+  pthread_mutex_lock(&f->lock);
+  while(1)
+  {
+    while(f->queued == 0 && f->pending > 0)
+      pthread_cond_wait(&f->wake, &f->lock);
+    if(f->queued == 0)
+      break;
+    struct DirJob job = f->queue[--f->queued];
+    pthread_mutex_unlock(&f->lock);
+    fsckCheckDir(f, &job);
+    free(job.path);
+    pthread_mutex_lock(&f->lock);
+    if(--f->pending == 0)
+      pthread_cond_broadcast(&f->wake);
+  }
+  pthread_mutex_unlock(&f->lock);
+  return NULL;
+}
+
+// checks the chain of every entry in one directory and queues its subdirectories
+void fsckCheckDir(struct Fsck *f, struct DirJob *job)
+{
+  struct Directory d;
+  memset(&d, 0, sizeof(d));
+  if(loadDirectory(&d, job->cluster) == -1)
+  {
+    fsckProblem(f, "Error: %s/: directory can not be read.", job->path);
+    dirRelease(&d);
+    return;
+  }
+  __atomic_fetch_add(&f->dirs, 1, __ATOMIC_RELAXED);
+  for(int i = 0; i < d.count; i++)
+  {
+    struct Fat32DirEntry *e = &d.entries[i];
+    // deleted entries, long name pieces, the volume label and the dot entries own nothing
+    if((uint8_t)e->DIR_Name[0] == 0xE5 || (e->DIR_Attr & 0x3F) == 0x0F || (e->DIR_Attr & 0x08) ||
+       e->DIR_Name[0] == '.')
+      continue;
+    char buffer[13];
+    const char *name = hostName(&d, i, buffer);
+    char *path = (char *)malloc(strlen(job->path) + strlen(name) + 2);
+    sprintf(path, "%s/%s", job->path, name);
+    uint32_t first = fat32EntryCluster(e);
+    int64_t length = fsckClaimChain(f, first, path);
+    if(e->DIR_Attr & 0x10)
+    {
+      // a directory is only followed if its whole chain was ours, which also stops a directory
+      // that links back to one of its parents from being walked forever
+      if(length > 0)
+      {
+        fsckQueue(f, first, path);
+        continue;
+      }
+      if(length == 0)
+        fsckProblem(f, "Error: %s/: directory has no clusters.", path);
+    }
+    else
+    {
+      __atomic_fetch_add(&f->files, 1, __ATOMIC_RELAXED);
+      int64_t needed = ((int64_t)e->DIR_FileSize + info->clusterSize - 1) / info->clusterSize;
+      if(length >= 0 && length != needed)
+        fsckProblem(f, "Error: %s: size %u needs %lld clusters but the chain has %lld.", path,
+                    e->DIR_FileSize, (long long)needed, (long long)length);
+    }
+    free(path);
+  }
+  dirRelease(&d);
+}
+
+/*
+ * parameters  : The fsck state, the first cluster of a chain and the path that owns it
+ * returns     : The length of the chain, or -1 if it was broken, looped or cross linked
+ * description : Claims every cluster of the chain in the shared bitmap. Problems are reported
+ *              as they are found and the walk stops at the first one.
+ */
+int64_t fsckClaimChain(struct Fsck *f, uint32_t first, const char *path)
+{
+  int64_t length = 0;
+  uint32_t c = first;
+  if(c == 0)
+    return 0;
+  while(1)
+  {
+    if(c < 2 || c >= info->clusterCount + 2)
+    {
+      fsckProblem(f, "Error: %s: chain points at invalid cluster %u.", path, c);
+      return -1;
+    }
+    uint64_t bit = 1ULL << (c % 64);
+    if(__atomic_fetch_or(&f->owned[c / 64], bit, __ATOMIC_RELAXED) & bit)
+    {
+      if(chainContains(first, length, c))
+        fsckProblem(f, "Error: %s: chain loops back to cluster %u.", path, c);
+      else
+        fsckProblem(f, "Error: %s: cross linked at cluster %u.", path, c);
+      return -1;
+    }
+    __atomic_fetch_add(&f->clusters, 1, __ATOMIC_RELAXED);
+    length++;
+    uint32_t next = fat32Entry(volume, c);
+    if(next > FAT32_BAD_CLUSTER)
+      return length;
+    if(next == FAT32_BAD_CLUSTER || next == 0)
+    {
+      fsckProblem(f, "Error: %s: chain runs into %s cluster %u.", path,
+                  next == 0 ? "free" : "bad", c);
+      return -1;
+    }
+    c = next;
+  }
+}
+
+// returns 1 if cluster is one of the first length clusters of the chain starting at first,
+// which tells a chain that loops back on itself from one that runs into another file's chain
+int chainContains(uint32_t first, int64_t length, uint32_t cluster)
+{
+  uint32_t c = first;
+  for(int64_t i = 0; i < length; i++)
+  {
+    if(c == cluster)
+      return 1;
+    c = fat32Entry(volume, c);
+  }
+  return 0;
+}
+
+// formats a problem and adds it to the list printed at the end
+void fsckProblem(struct Fsck *f, const char *format, ...)
+{
+  char *text = NULL;
+  va_list args;
+  va_start(args, format);
+  if(vasprintf(&text, format, args) == -1)
+    text = NULL;
+  va_end(args);
+  if(text == NULL)
+    return;
+  pthread_mutex_lock(&f->lock);
+  if(f->problemCount == f->problemCapacity)
+  {
+    f->problemCapacity = f->problemCapacity ? f->problemCapacity * 2 : 16;
+    f->problems = (char **)realloc(f->problems, sizeof(char *) * f->problemCapacity);
+  }
+  f->problems[f->problemCount++] = text;
+  pthread_mutex_unlock(&f->lock);
+}
+
+// hands a directory to the fsck threads, path is freed once it has been checked
+void fsckQueue(struct Fsck *f, uint32_t cluster, char *path)
+{
+  pthread_mutex_lock(&f->lock);
+  if(f->queued == f->queueCapacity)
+  {
+    f->queueCapacity = f->queueCapacity ? f->queueCapacity * 2 : 64;
+    f->queue = (struct DirJob *)realloc(f->queue, sizeof(struct DirJob) * f->queueCapacity);
+  }
+  f->queue[f->queued].cluster = cluster;
+  f->queue[f->queued].path = path;
+  f->queued++;
+  f->pending++;
+  pthread_cond_signal(&f->wake);
+  pthread_mutex_unlock(&f->lock);
+}
+
+// returns how many of the data cluster entries of the given FAT copy differ from the first FAT
+uint64_t fsckCompareFats(int copy)
+{
+  uint64_t differ = 0;
+  off_t first = info->fatStart;
+  off_t other = first + copy * info->fatSize;
+  uint32_t chunk = FAT_CHUNK_ENTRIES;
+  uint32_t *a = (uint32_t *)malloc(sizeof(uint32_t) * chunk);
+  uint32_t *b = (uint32_t *)malloc(sizeof(uint32_t) * chunk);
+  for(uint32_t c = 2; c < info->clusterCount + 2; c += chunk)
+  {
+    uint32_t n = info->clusterCount + 2 - c < chunk ? info->clusterCount + 2 - c : chunk;
+    if(fat32ReadDirect(volume, a, first + (off_t)c * 4, n * 4) == -1 ||
+       fat32ReadDirect(volume, b, other + (off_t)c * 4, n * 4) == -1)
+      break;
+    // whole chunks that match are the common case and memcmp gets through them fastest
+    if(memcmp(a, b, n * 4) == 0)
+      continue;
+    for(uint32_t i = 0; i < n; i++)
+      differ += (a[i] & FAT32_ENTRY_MASK) != (b[i] & FAT32_ENTRY_MASK);
+  }
+  free(a);
+  free(b);
+  return differ;
+}
+
+// qsort comparison for an array of strings
+int compareStrings(const void *a, const void *b)
+{
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+void printInfo()
+{
+  printf("BPB_BytsPerSec:\t %d\t 0x%x\n", info->BPB_BytsPerSec, info->BPB_BytsPerSec);
+  printf("BPB_SecPerClus:\t %d\t 0x%x\n", info->BPB_SecPerClus, info->BPB_SecPerClus);
+  printf("BPB_RsvdSecCnt:\t %d\t 0x%x\n", info->BPB_RsvdSecCnt, info->BPB_RsvdSecCnt);
+  printf("BPB_NumFATs:\t %d\t 0x%x\n", info->BPB_NumFATs, info->BPB_NumFATs);
+  printf("BPB_FATSz32:\t %d\t 0x%x\n", info->BPB_FATSz32, info->BPB_FATSz32);
+}
+
+// accepts a char pointer and will get rid of any leading white spoce by shifting the whole string
+// in place. no return type as everything is done on the same pointer.
+void sanitizeString(char * strPtr)
 {
   while(*strPtr == ' ' || *strPtr == '\t')
   {
@@ -516,6 +4133,24 @@ void sanitizeString(char * strPtr)
   }
 }
 
+// splits the next token off of *str the same way strsep() does, except that a token starting
+// with a double quote runs up to the closing quote. that way long names with spaces can be typed
+char *nextToken(char **str)
+{
+  char *start = *str;
+  if(start != NULL && *start == '"')
+  {
+    char *end = strchr(start + 1, '"');
+    if(end != NULL)
+    {
+      *end = '\0';
+      *str = end[1] == '\0' ? NULL : end + 2;
+      return start + 1;
+    }
+  }
+  return strsep(str, WHITESPACE);
+}
+
 // helper function for testing. prints a line of any char passed in
 void show(char x)
 {
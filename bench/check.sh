@@ -0,0 +1,259 @@
+#!/bin/sh
+#
+# Checks mfs and msh against known results, run by "make check". mkfat32 builds small images
+# and writes the same tree to the host with -x, so whatever mfs copies out of an image can be
+# compared byte for byte with what it should hold. Every check prints ok or FAIL and the script
+# exits with 1 if any of them failed.
+
+MFS=${MFS:-./mfs}
+MSH=${MSH:-./msh}
+MKFAT32=${MKFAT32:-bench/mkfat32}
+
+case $MFS in /*) ;; *) MFS=$(pwd)/$MFS ;; esac
+case $MSH in /*) ;; *) MSH=$(pwd)/$MSH ;; esac
+
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+failures=0
+
+pass()
+{
+  echo "ok    $1"
+}
+
+fail()
+{
+  echo "FAIL  $1"
+  failures=$((failures + 1))
+}
+
+# runs mfs in batch mode on an image from inside $WORK/out, the rest of the arguments are
+# commands. the JSON records go to $WORK/batch.log
+mfsBatch()
+{
+  image=$1
+  shift
+  for command in "$@"
+  do
+    set -- "$@" -c "$command"
+    shift
+  done
+  (cd "$WORK/out" && "$MFS" -i "$image" "$@" < /dev/null > "$WORK/batch.log" 2>&1)
+}
+
+# fails the check if any command in the last batch reported an error
+batchClean()
+{
+  if grep -q '"status": "error"' "$WORK/batch.log"
+  then
+    fail "$1"
+    grep '"status": "error"' "$WORK/batch.log" | sed 's/^/      /'
+    return 1
+  fi
+  return 0
+}
+
+# sha256 of every file under a host directory in the form sum -r prints, without the crc32,
+# sorted
+expectedSums()
+{
+  (cd "$1" && find . -type f | sed 's|^\./||' | while IFS= read -r f
+  do
+    printf '%s  %s\n' "$(sha256sum < "$f" | cut -c1-64)" "$f"
+  done) | LC_ALL=C sort
+}
+
+# builds an image with mkfat32 and checks that get -r, export and sum -r all give back exactly
+# the tree it was built from, and that fsck finds nothing wrong with it
+checkImage()
+{
+  label=$1
+  shift
+  image=$WORK/$label.img
+  rm -rf "$WORK/expected" "$WORK/out"
+  mkdir "$WORK/out"
+  if ! "$MKFAT32" -o "$image" -x "$WORK/expected" "$@" > /dev/null 2>&1
+  then
+    fail "$label: mkfat32 $*"
+    return
+  fi
+
+  mfsBatch "$image" "get -r / tree" "export / tree.tar" "sum -r /" "fsck"
+  batchClean "$label: batch" || return
+
+  if diff -r "$WORK/expected" "$WORK/out/tree" > /dev/null
+  then
+    pass "$label: get -r matches the generated tree"
+  else
+    fail "$label: get -r matches the generated tree"
+  fi
+
+  mkdir "$WORK/out/untar"
+  if tar -xf "$WORK/out/tree.tar" -C "$WORK/out/untar" &&
+     diff -r "$WORK/expected" "$WORK/out/untar" > /dev/null
+  then
+    pass "$label: export matches the generated tree"
+  else
+    fail "$label: export matches the generated tree"
+  fi
+
+  expectedSums "$WORK/expected" > "$WORK/sums.expected"
+  grep '"command": "sum -r /"' "$WORK/batch.log" | sed 's/.*"output": "//; s/"}$//' |
+    sed 's/\\n/\n/g' | sed '/^$/d' | cut -d' ' -f2- | LC_ALL=C sort > "$WORK/sums.actual"
+  if [ -s "$WORK/sums.expected" ] && cmp -s "$WORK/sums.expected" "$WORK/sums.actual"
+  then
+    pass "$label: sum -r matches sha256sum"
+  else
+    fail "$label: sum -r matches sha256sum"
+  fi
+
+  if grep '"command": "fsck"' "$WORK/batch.log" | grep -q 'No problems found'
+  then
+    pass "$label: fsck is clean"
+  else
+    fail "$label: fsck is clean"
+  fi
+}
+
+# puts files of awkward sizes and enough long names to grow a directory several times, checks
+# they come back the same, then deletes them and checks the volume is back where it started
+checkPutDel()
+{
+  image=$WORK/put.img
+  rm -rf "$WORK/expected" "$WORK/out" "$WORK/put"
+  mkdir "$WORK/out" "$WORK/put"
+  if ! "$MKFAT32" -o "$image" -x "$WORK/expected" -s 40M -c 512 -d 1 -l 1 -f 2 -z 1K-4K -F 30 \
+       > /dev/null 2>&1
+  then
+    fail "put: mkfat32"
+    return
+  fi
+  : > "$WORK/put/EMPTY.TXT"
+  head -c 1024 /dev/urandom > "$WORK/put/EXACT.BIN"
+  head -c 7777 /dev/urandom > "$WORK/put/odd.dat"
+  head -c 3000000 /dev/urandom > "$WORK/put/big.bin"
+  i=0
+  while [ $i -lt 40 ]
+  do
+    head -c $((i * 97)) /dev/urandom > "$WORK/put/Long_file_name_number_$i.dat"
+    i=$((i + 1))
+  done
+  names=$(cd "$WORK/put" && ls)
+
+  # fsck counts every directory and file, and any cluster del leaves allocated shows up as lost
+  countsBefore=$("$MFS" -i "$image" -c fsck < /dev/null | grep '"command": "fsck"' |
+                 sed 's/.*"output": "\(Directories:[^F]*Files:\\t\\t [0-9]*\).*/\1/')
+
+  set -- "cd DIR00000"
+  for name in $names
+  do
+    set -- "$@" "put $WORK/put/$name"
+  done
+  set -- "$@" fsck
+  for name in $names
+  do
+    set -- "$@" "get $name"
+  done
+  mfsBatch "$image" "$@"
+  if batchClean "put: put and get" &&
+     grep '"command": "fsck"' "$WORK/batch.log" | grep -q 'No problems found'
+  then
+    pass "put: fsck is clean after put"
+  else
+    fail "put: fsck is clean after put"
+  fi
+  same=1
+  for name in $names
+  do
+    cmp -s "$WORK/put/$name" "$WORK/out/$name" || same=0
+  done
+  if [ $same -eq 1 ]
+  then
+    pass "put: get gives back what was put"
+  else
+    fail "put: get gives back what was put"
+  fi
+
+  set -- "cd DIR00000"
+  for name in $names
+  do
+    set -- "$@" "del $name"
+  done
+  mfsBatch "$image" "$@" fsck df "get -r / tree"
+  if batchClean "put: del" &&
+     grep '"command": "fsck"' "$WORK/batch.log" | grep -q 'No problems found' &&
+     grep '"command": "df"' "$WORK/batch.log" | grep -q 'FSInfo free:\\t [0-9]*\\t matches'
+  then
+    pass "put: fsck is clean and FSInfo matches after del"
+  else
+    fail "put: fsck is clean and FSInfo matches after del"
+  fi
+  countsAfter=$(grep '"command": "fsck"' "$WORK/batch.log" |
+                sed 's/.*"output": "\(Directories:[^F]*Files:\\t\\t [0-9]*\).*/\1/')
+  if [ -n "$countsBefore" ] && [ "$countsBefore" = "$countsAfter" ] &&
+     diff -r "$WORK/expected" "$WORK/out/tree" > /dev/null
+  then
+    pass "put: del removes every file and leaves the rest alone"
+  else
+    fail "put: del removes every file and leaves the rest alone"
+  fi
+}
+
+# runs a few lines through msh, pids are replaced since they change from run to run
+checkShell()
+{
+  printf '%s\n' \
+    'echo hello world | tr a-z A-Z | rev' \
+    'status' \
+    'false' \
+    'status' \
+    'sleep 0.3 &' \
+    'jobs' \
+    'sleep 1' \
+    'echo done waiting' \
+    'nosuchcommand' \
+    'echo a | | b' \
+    'echo 1 2 3 4 5 6 7 8 9 10 11 12' \
+    "echo $(i=0; while [ $i -lt 100 ]; do printf 'a '; i=$((i + 1)); done)" \
+    'quit' |
+    (cd "$WORK" && timeout 10 "$MSH" 2>&1; echo) |
+    sed 's/([0-9]*)/(pid)/; s/^\(msh> \)*\[1\] [0-9]*$/\1[1] pid/; s/ *$//' > "$WORK/msh.actual"
+  cat > "$WORK/msh.expected" <<'EOF'
+msh> DLROW OLLEH
+msh> 1: echo (pid) exited with 0
+2: tr (pid) exited with 0
+3: rev (pid) exited with 0
+msh> msh> 1: false (pid) exited with 1
+msh> [1] pid
+msh> [1]+ Running  sleep 0.3 &
+msh> [1] Done sleep 0.3 &
+msh> done waiting
+msh> nosuchcommand: Command not found.
+msh> Syntax error near |.
+msh> Too many arguments.
+msh> Too many arguments.
+msh>
+EOF
+  if diff "$WORK/msh.expected" "$WORK/msh.actual" > "$WORK/msh.diff"
+  then
+    pass "msh: pipelines, status, jobs and errors"
+  else
+    fail "msh: pipelines, status, jobs and errors"
+    sed 's/^/      /' "$WORK/msh.diff"
+  fi
+}
+
+# small files in order under long names, big fragmented files, and the same far into a volume
+# so cluster numbers need their high word
+checkImage tree -s 64M -c 1K -d 3 -l 3 -f 5 -z 0-20K -L
+checkImage frag -s 128M -c 4K -d 2 -l 2 -f 3 -z 100K-2M -F 50
+checkImage high -s 8G -c 4K -d 1 -l 2 -f 3 -z 1-300K -F 50 -S 6G
+checkPutDel
+checkShell
+
+if [ $failures -ne 0 ]
+then
+  echo "$failures checks failed"
+  exit 1
+fi
+echo "all checks passed"
@@ -0,0 +1,326 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Trevor Bakker
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+/*
+ * mfsbench times mfs on an image. Every operation is run many times in one batch mode process
+ * ("mfs -i image -f commands") so the cost of starting mfs and opening the image is paid once,
+ * and that cost, measured on its own, is taken off again. Each batch runs a few times and the
+ * fastest run counts. One more run happens under ptrace to count the system calls of every
+ * thread. The counts include what batch mode spends capturing each command's output.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/ptrace.h>
+
+#define DEFAULT_OPS 1000        // operations per batch for everything but get
+#define DEFAULT_GETS 20         // files copied per get batch
+#define DEFAULT_RUNS 5          // timed runs of every batch, the fastest one counts
+
+// The result of running one batch of commands
+struct Measurement
+{
+  double seconds;               // wall time of the fastest run
+  long syscalls;                // system calls of the traced run, -1 if ptrace failed
+};
+
+const char *mfs = NULL;
+char image[4096];
+
+void usage(const char *name);
+int writeCommands(const char *path, const char *command, int count);
+struct Measurement measure(const char *commands, const char *dir, int runs);
+double timeRun(char **argv, const char *dir);
+long traceRun(char **argv, const char *dir);
+pid_t launch(char **argv, const char *dir, int traced, int outFd);
+long fileSize(const char *name);
+void report(const char *name, int ops, struct Measurement *m, struct Measurement *base, double bytes);
+
+int main(int argc, char *argv[])
+{
+  int ops = DEFAULT_OPS;
+  int gets = DEFAULT_GETS;
+  int runs = DEFAULT_RUNS;
+  const char *deep = "/DIR00000/DIR00000/DIR00000";
+  const char *file = "F0000000.BIN";
+  int c;
+  while((c = getopt(argc, argv, "n:g:r:p:s:")) != -1)
+  {
+    switch(c)
+    {
+      case 'n':
+        ops = atoi(optarg);
+        break;
+      case 'g':
+        gets = atoi(optarg);
+        break;
+      case 'r':
+        runs = atoi(optarg);
+        break;
+      case 'p':
+        deep = optarg;
+        break;
+      case 's':
+        file = optarg;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if(argc - optind != 2 || ops < 1 || gets < 1 || runs < 1)
+    usage(argv[0]);
+  mfs = realpath(argv[optind], NULL);
+  if(mfs == NULL || realpath(argv[optind + 1], image) == NULL)
+  {
+    fprintf(stderr, "Error: %s\n", strerror(errno));
+    return 1;
+  }
+
+  char dir[] = "/tmp/mfsbenchXXXXXX";
+  if(mkdtemp(dir) == NULL)
+  {
+    fprintf(stderr, "Error: Could not make a scratch directory: %s\n", strerror(errno));
+    return 1;
+  }
+  char commands[sizeof(dir) + 16];
+  snprintf(commands, sizeof(commands), "%s/commands", dir);
+  long size = fileSize(file);
+  if(size < 0)
+  {
+    fprintf(stderr, "Error: %s is not in the root directory of %s\n", file, image);
+    rmdir(dir);
+    return 1;
+  }
+
+  printf("%s: %d operations per batch (%d for get), fastest of %d runs\n", image, ops, gets, runs);
+  printf("%-10s %8s %10s %10s %10s %10s %9s %9s\n", "operation", "ops", "time ms", "us/op",
+         "ops/s", "syscalls", "calls/op", "MB/s");
+  char command[4096];
+  writeCommands(commands, NULL, 0);
+  struct Measurement base = measure(commands, dir, runs);
+  report("open", 1, &base, NULL, 0);
+
+  writeCommands(commands, "ls", ops);
+  struct Measurement m = measure(commands, dir, runs);
+  report("ls", ops, &m, &base, 0);
+
+  snprintf(command, sizeof(command), "cd \"%s\"", deep);
+  writeCommands(commands, command, ops);
+  m = measure(commands, dir, runs);
+  report("cd deep", ops, &m, &base, 0);
+
+  snprintf(command, sizeof(command), "stat \"%s\"", file);
+  writeCommands(commands, command, ops);
+  m = measure(commands, dir, runs);
+  report("stat", ops, &m, &base, 0);
+
+  snprintf(command, sizeof(command), "get \"%s\"", file);
+  writeCommands(commands, command, gets);
+  m = measure(commands, dir, runs);
+  report("get", gets, &m, &base, (double)size * gets);
+
+  char copy[sizeof(dir) + 4096];
+  snprintf(copy, sizeof(copy), "%s/%s", dir, file);
+  unlink(copy);
+  unlink(commands);
+  rmdir(dir);
+  return 0;
+}
+
+void usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-n ops] [-g gets] [-r runs] [-p deep path] [-s file] mfs image\n"
+          "  -p is a directory cd goes to, -s a file in the root that stat and get use\n", name);
+  exit(1);
+}
+
+// writes count copies of command to path, one per line
+int writeCommands(const char *path, const char *command, int count)
+{
+  FILE *f = fopen(path, "w");
+  if(f == NULL)
+    return -1;
+  for(int i = 0; i < count; i++)
+    fprintf(f, "%s\n", command);
+  fclose(f);
+  return 0;
+}
+
+// runs mfs on the image and the command file runs times, then once more to count system calls
+struct Measurement measure(const char *commands, const char *dir, int runs)
+{
+  char *argv[] = { (char *)mfs, "-i", image, "-f", (char *)commands, NULL };
+  struct Measurement m;
+  m.seconds = -1;
+  for(int i = 0; i < runs; i++)
+  {
+    double t = timeRun(argv, dir);
+    if(m.seconds < 0 || (t >= 0 && t < m.seconds))
+      m.seconds = t;
+  }
+  m.syscalls = traceRun(argv, dir);
+  return m;
+}
+
+// returns the wall time of one run in seconds, -1 if it failed
+double timeRun(char **argv, const char *dir)
+{
+  struct timespec start;
+  struct timespec end;
+  int status;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pid_t pid = launch(argv, dir, 0, -1);
+  if(pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    return -1;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*
+ * parameters  : The command to run and the directory to run it in
+ * returns     : The number of system calls made by all of its threads, -1 if it could not
+ *              be traced
+ * description : Runs the command under ptrace, stopping at every system call entry and exit.
+ *              New threads are traced as they are created. Entries are told apart from exits
+ *              with PTRACE_GET_SYSCALL_INFO.
+ */
+long traceRun(char **argv, const char *dir)
+{
+  int status;
+  pid_t pid = launch(argv, dir, 1, -1);
+  if(pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status))
+    return -1;
+  if(ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE |
+            PTRACE_O_EXITKILL) == -1)
+  {
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    return -1;
+  }
+  ptrace(PTRACE_SYSCALL, pid, 0, 0);
+  long count = 0;
+  while(1)
+  {
+    pid_t tid = waitpid(-1, &status, __WALL);
+    if(tid == -1)
+      break;
+    if(!WIFSTOPPED(status))
+      continue;
+    int sig = WSTOPSIG(status);
+    if(sig == (SIGTRAP | 0x80))
+    {
+      struct __ptrace_syscall_info info;
+      if(ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) > 0 &&
+         info.op == PTRACE_SYSCALL_INFO_ENTRY)
+        count++;
+      sig = 0;
+    }
+    // the stop after exec, clone events and the stop new threads start in are not passed on
+    else if(sig == SIGTRAP || sig == SIGSTOP)
+      sig = 0;
+    ptrace(PTRACE_SYSCALL, tid, 0, sig);
+  }
+  return count;
+}
+
+// starts argv in dir with its output going to outFd, or /dev/null if outFd is -1. a traced
+// child stops itself before exec so the tracer can set its options
+pid_t launch(char **argv, const char *dir, int traced, int outFd)
+{
+  pid_t pid = fork();
+  if(pid != 0)
+    return pid;
+  int null = open("/dev/null", O_RDWR);
+  dup2(outFd == -1 ? null : outFd, STDOUT_FILENO);
+  if(dir != NULL && chdir(dir) == -1)
+    _exit(127);
+  if(traced)
+  {
+    ptrace(PTRACE_TRACEME, 0, 0, 0);
+    raise(SIGSTOP);
+  }
+  execv(argv[0], argv);
+  _exit(127);
+}
+
+// asks mfs for the size of a file in the root directory, -1 if it is not there
+long fileSize(const char *name)
+{
+  int fds[2];
+  char command[4096];
+  snprintf(command, sizeof(command), "stat \"%s\"", name);
+  char *argv[] = { (char *)mfs, "-i", image, "-c", command, NULL };
+  if(pipe(fds) == -1)
+    return -1;
+  pid_t pid = launch(argv, NULL, 0, fds[1]);
+  close(fds[1]);
+  char output[8192];
+  size_t used = 0;
+  ssize_t n;
+  while(used < sizeof(output) - 1 && (n = read(fds[0], output + used, sizeof(output) - 1 - used)) > 0)
+    used += n;
+  output[used] = '\0';
+  close(fds[0]);
+  waitpid(pid, NULL, 0);
+  // the output comes JSON escaped, "Size: \t\t 1234"
+  char *size = strstr(output, "Size: \\t\\t ");
+  return size == NULL ? -1 : atol(size + strlen("Size: \\t\\t "));
+}
+
+// prints one line of results, with the cost of the open measured in base taken off first
+void report(const char *name, int ops, struct Measurement *m, struct Measurement *base, double bytes)
+{
+  if(m->seconds < 0)
+  {
+    printf("%-10s failed\n", name);
+    return;
+  }
+  double seconds = m->seconds;
+  long syscalls = m->syscalls;
+  if(base != NULL)
+  {
+    seconds -= base->seconds;
+    if(seconds < 0)
+      seconds = 0;
+    if(syscalls >= 0 && base->syscalls >= 0)
+      syscalls -= base->syscalls;
+  }
+  printf("%-10s %8d %10.2f %10.2f %10.0f", name, ops, seconds * 1e3, seconds * 1e6 / ops,
+         seconds > 0 ? ops / seconds : 0);
+  if(syscalls >= 0)
+    printf(" %10ld %9.1f", syscalls, (double)syscalls / ops);
+  else
+    printf(" %10s %9s", "-", "-");
+  if(bytes > 0 && seconds > 0)
+    printf(" %9.1f", bytes / seconds / (1024 * 1024));
+  printf("\n");
+}
@@ -0,0 +1,665 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Trevor Bakker
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+/*
+ * mkfat32 builds a synthetic FAT32 image for testing and benchmarking mfs, without needing
+ * mkfs or mtools. The volume is a tree of directories DIR00000, DIR00001, ... nested depth
+ * levels deep with fanout subdirectories each, and every directory (the root included) holds
+ * files F0000000.BIN, F0000001.BIN, ... The image is written sparse, only the metadata and the
+ * file contents take up space on the host. Everything but the root's first cluster can be
+ * placed far into the volume, so a large image exercises cluster numbers above 16 bits and
+ * byte offsets above 4 GB without the host having to store what comes before. With -x the same
+ * tree is also written to a host directory, under the names mfs gives the files when it copies
+ * them out, so its output can be compared with what the image should hold.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#define BYTES_PER_SECTOR 512
+#define RESERVED_SECTORS 32
+#define NUM_FATS 2
+#define ROOT_CLUSTER 2
+#define FSINFO_SECTOR 1
+#define BACKUP_BOOT_SECTOR 6
+
+#define FAT_END_OF_CHAIN 0x0FFFFFFF
+#define MAX_DEPTH 64
+#define FAT_WRITE_CHUNK 65536   // Bytes of FAT checked for being all zero at a time
+
+struct __attribute__((__packed__)) DirectoryEntry
+{
+  char DIR_Name[11];
+  uint8_t DIR_Attr;
+  uint8_t DIR_NTRes;
+  uint8_t DIR_CrtTimeTenth;
+  uint16_t DIR_CrtTime;
+  uint16_t DIR_CrtDate;
+  uint16_t DIR_LstAccDate;
+  uint16_t DIR_FirstClusterHigh;
+  uint16_t DIR_WrtTime;
+  uint16_t DIR_WrtDate;
+  uint16_t DIR_FirstClusterLow;
+  uint32_t DIR_FileSize;
+};
+
+// Everything the generator is asked for on the command line
+struct Options
+{
+  const char *path;             // image to create
+  uint64_t size;                // image size in bytes
+  uint32_t clusterSize;         // bytes per cluster
+  int fanout;                   // subdirectories in every directory above the last level
+  int depth;                    // levels of directories below the root
+  int files;                    // files in every directory
+  uint32_t minFile;             // file sizes are picked uniformly between these two
+  uint32_t maxFile;
+  int fragmentation;            // percent chance that a cluster does not follow the previous one
+  int longNames;                // 1 to give every file a long name as well
+  uint64_t start;               // byte offset into the data area where allocation starts
+  unsigned seed;
+  const char *expected;         // host directory that gets a copy of the tree, NULL for none
+};
+
+struct Options opt;
+int imageFd = -1;
+uint32_t *fat = NULL;           // the whole FAT, written out once at the end
+uint32_t clusterCount = 0;      // data clusters, numbered 2 to clusterCount + 1
+uint32_t nextCluster = 3;       // where sequential allocation continues
+uint32_t freeClusters = 0;
+uint64_t dataStart = 0;         // byte offset of cluster 2
+uint8_t *fill = NULL;           // one cluster of file contents
+uint64_t dirsMade = 0;
+uint64_t filesMade = 0;
+uint64_t random64 = 0;          // state of the xorshift generator
+
+void usage(const char *name);
+int parseSize(const char *str, uint64_t *value);
+uint64_t nextRandom();
+uint32_t allocCluster(uint32_t previous);
+uint32_t allocChain(uint32_t count, int fragment);
+int writeChain(uint32_t first, const void *data, uint64_t len);
+int writeFile(uint32_t first, uint32_t size, int hostFd);
+uint32_t makeDirectory(uint32_t parent, int level, const char *hostDir);
+void makeEntry(struct DirectoryEntry *e, const char *name, uint8_t attr, uint32_t cluster, uint32_t size);
+int makeLongName(struct DirectoryEntry *entries, const char *longName, const char *shortName);
+int writeBootSectors(uint32_t fatSize);
+int writeAll(int fd, const void *buf, size_t len, off_t offset);
+int writeSparse(int fd, const void *buf, size_t len, off_t offset);
+
+int main(int argc, char *argv[])
+{
+  opt.size = 256ULL * 1024 * 1024;
+  opt.clusterSize = 4096;
+  opt.fanout = 4;
+  opt.depth = 3;
+  opt.files = 16;
+  opt.minFile = 1024;
+  opt.maxFile = 64 * 1024;
+  opt.seed = 1;
+  int c;
+  while((c = getopt(argc, argv, "o:s:c:d:l:f:z:F:LS:r:x:")) != -1)
+  {
+    uint64_t value = 0;
+    char *dash;
+    switch(c)
+    {
+      case 'o':
+        opt.path = optarg;
+        break;
+      case 's':
+        if(parseSize(optarg, &opt.size) == -1)
+          usage(argv[0]);
+        break;
+      case 'c':
+        if(parseSize(optarg, &value) == -1 || value < BYTES_PER_SECTOR || value > 65536 ||
+           (value & (value - 1)) != 0)
+          usage(argv[0]);
+        opt.clusterSize = value;
+        break;
+      case 'd':
+        opt.fanout = atoi(optarg);
+        break;
+      case 'l':
+        opt.depth = atoi(optarg);
+        break;
+      case 'f':
+        opt.files = atoi(optarg);
+        break;
+      case 'z':
+        // either one size or min-max
+        dash = strchr(optarg, '-');
+        if(dash != NULL)
+          *dash = '\0';
+        if(parseSize(optarg, &value) == -1)
+          usage(argv[0]);
+        opt.minFile = opt.maxFile = value;
+        if(dash != NULL && (parseSize(dash + 1, &value) == -1 || value < opt.minFile))
+          usage(argv[0]);
+        opt.maxFile = value;
+        break;
+      case 'F':
+        opt.fragmentation = atoi(optarg);
+        break;
+      case 'L':
+        opt.longNames = 1;
+        break;
+      case 'S':
+        if(parseSize(optarg, &opt.start) == -1)
+          usage(argv[0]);
+        break;
+      case 'r':
+        opt.seed = strtoul(optarg, NULL, 10);
+        break;
+      case 'x':
+        opt.expected = optarg;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if(opt.path == NULL || opt.fanout < 0 || opt.depth < 0 || opt.depth > MAX_DEPTH ||
+     opt.files < 0 || opt.fragmentation < 0 || opt.fragmentation > 100)
+    usage(argv[0]);
+  random64 = 0x9E3779B97F4A7C15ULL ^ opt.seed;
+
+  // the FAT size comes from the formula in the FAT32 specification
+  uint32_t sectorsPerCluster = opt.clusterSize / BYTES_PER_SECTOR;
+  uint64_t totalSectors = opt.size / BYTES_PER_SECTOR;
+  if(totalSectors > UINT32_MAX)
+  {
+    fprintf(stderr, "Error: Images are limited to 2 TB.\n");
+    return 1;
+  }
+  uint32_t perFatSector = (256 * sectorsPerCluster + NUM_FATS) / 2;
+  uint32_t fatSize = totalSectors > RESERVED_SECTORS ?
+                     (totalSectors - RESERVED_SECTORS + perFatSector - 1) / perFatSector : 0;
+  if(totalSectors <= RESERVED_SECTORS + (uint64_t)NUM_FATS * fatSize + sectorsPerCluster)
+  {
+    fprintf(stderr, "Error: Image is too small.\n");
+    return 1;
+  }
+  uint64_t dataSectors = totalSectors - RESERVED_SECTORS - (uint64_t)NUM_FATS * fatSize;
+  clusterCount = dataSectors / sectorsPerCluster;
+  if(clusterCount < 65525)
+    fprintf(stderr, "Warning: %u clusters is too few for other tools to accept this as FAT32.\n",
+            clusterCount);
+  dataStart = (uint64_t)(RESERVED_SECTORS + NUM_FATS * fatSize) * BYTES_PER_SECTOR;
+  if(opt.start / opt.clusterSize >= clusterCount)
+  {
+    fprintf(stderr, "Error: The start offset is past the end of the volume.\n");
+    return 1;
+  }
+  if(opt.start >= opt.clusterSize)
+    nextCluster = 2 + opt.start / opt.clusterSize;
+
+  imageFd = open(opt.path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(imageFd == -1 || ftruncate(imageFd, (off_t)totalSectors * BYTES_PER_SECTOR) == -1)
+  {
+    fprintf(stderr, "Error: Could not create %s: %s\n", opt.path, strerror(errno));
+    return 1;
+  }
+  fat = (uint32_t *)calloc((uint64_t)fatSize * BYTES_PER_SECTOR / 4, sizeof(uint32_t));
+  fill = (uint8_t *)malloc(opt.clusterSize);
+  if(fat == NULL || fill == NULL)
+  {
+    fprintf(stderr, "Error: Out of memory.\n");
+    return 1;
+  }
+  fat[0] = 0x0FFFFFF8;
+  fat[1] = FAT_END_OF_CHAIN;
+  fat[ROOT_CLUSTER] = FAT_END_OF_CHAIN;
+  freeClusters = clusterCount - 1;
+
+  if(opt.expected != NULL && mkdir(opt.expected, 0755) == -1 && errno != EEXIST)
+  {
+    fprintf(stderr, "Error: Could not create %s: %s\n", opt.expected, strerror(errno));
+    return 1;
+  }
+  if(makeDirectory(0, 0, opt.expected) == 0 || writeBootSectors(fatSize) == -1)
+  {
+    fprintf(stderr, "Error: Could not build %s, is the image big enough?\n", opt.path);
+    unlink(opt.path);
+    return 1;
+  }
+  // the FAT copies go out last since building the tree keeps changing them
+  for(int i = 0; i < NUM_FATS; i++)
+  {
+    off_t offset = (off_t)(RESERVED_SECTORS + i * fatSize) * BYTES_PER_SECTOR;
+    if(writeSparse(imageFd, fat, (size_t)fatSize * BYTES_PER_SECTOR, offset) == -1)
+    {
+      fprintf(stderr, "Error: Could not write the FAT.\n");
+      return 1;
+    }
+  }
+  close(imageFd);
+  printf("%s: %u clusters of %u bytes, %llu directories, %llu files, %u clusters free\n",
+         opt.path, clusterCount, opt.clusterSize, (unsigned long long)dirsMade,
+         (unsigned long long)filesMade, freeClusters);
+  free(fat);
+  free(fill);
+  return 0;
+}
+
+void usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s -o image [-s size] [-c clustersize] [-d fanout] [-l depth] [-f files]\n"
+          "          [-z size|min-max] [-F fragmentation%%] [-L] [-S start] [-r seed] [-x dir]\n"
+          "  sizes take a K, M or G suffix, -S leaves the first start bytes of the data area\n"
+          "  unused, -x also writes the tree to dir on the host\n", name);
+  exit(1);
+}
+
+// reads a number with an optional K, M or G suffix, returns -1 if it is not one
+int parseSize(const char *str, uint64_t *value)
+{
+  char *end;
+  errno = 0;
+  uint64_t v = strtoull(str, &end, 10);
+  if(end == str || errno != 0)
+    return -1;
+  switch(*end)
+  {
+    case 'G': case 'g': v <<= 10; // fall through
+    case 'M': case 'm': v <<= 10; // fall through
+    case 'K': case 'k': v <<= 10; end++; break;
+    case '\0': break;
+    default: return -1;
+  }
+  if(*end != '\0')
+    return -1;
+  *value = v;
+  return 0;
+}
+
+// xorshift64*, good enough for picking sizes and scattering clusters and the same for a seed
+uint64_t nextRandom()
+{
+  random64 ^= random64 >> 12;
+  random64 ^= random64 << 25;
+  random64 ^= random64 >> 27;
+  return random64 * 2685821657736338717ULL;
+}
+
+/*
+ * parameters  : The cluster the new one follows in its chain, 0 for the first cluster
+ * returns     : A free cluster, or 0 if the volume is full
+ * description : Clusters are handed out in order unless the fragmentation roll says to jump
+ *              to a random spot, in which case the search for a free cluster starts there.
+ */
+uint32_t allocCluster(uint32_t previous)
+{
+  if(freeClusters == 0)
+    return 0;
+  uint32_t start = nextCluster;
+  if(previous != 0 && (int)(nextRandom() % 100) < opt.fragmentation)
+    start = 2 + nextRandom() % clusterCount;
+  uint32_t c = start;
+  while(fat[c] != 0)
+  {
+    c = c + 1 < clusterCount + 2 ? c + 1 : 2;
+    if(c == start)
+      return 0;
+  }
+  fat[c] = FAT_END_OF_CHAIN;
+  if(previous != 0)
+    fat[previous] = c;
+  if(start == nextCluster)
+    nextCluster = c + 1 < clusterCount + 2 ? c + 1 : 2;
+  freeClusters--;
+  return c;
+}
+
+// allocates a chain of count clusters and returns its first cluster, 0 if the volume is full.
+// directories are never fragmented
+uint32_t allocChain(uint32_t count, int fragment)
+{
+  int saved = opt.fragmentation;
+  if(!fragment)
+    opt.fragmentation = 0;
+  uint32_t first = 0;
+  uint32_t last = 0;
+  for(uint32_t i = 0; i < count; i++)
+  {
+    last = allocCluster(last);
+    if(last == 0)
+    {
+      first = 0;
+      break;
+    }
+    if(first == 0)
+      first = last;
+  }
+  opt.fragmentation = saved;
+  return first;
+}
+
+// writes data along the chain starting at first, one write per run of adjacent clusters
+int writeChain(uint32_t first, const void *data, uint64_t len)
+{
+  const uint8_t *in = data;
+  uint32_t c = first;
+  while(len > 0 && c >= 2 && c < FAT_END_OF_CHAIN - 8)
+  {
+    uint32_t runStart = c;
+    uint64_t run = opt.clusterSize;
+    while(run < len && fat[c] == c + 1)
+    {
+      c++;
+      run += opt.clusterSize;
+    }
+    if(run > len)
+      run = len;
+    if(writeAll(imageFd, in, run, dataStart + (uint64_t)(runStart - 2) * opt.clusterSize) == -1)
+      return -1;
+    in += run;
+    len -= run;
+    c = fat[c];
+  }
+  return 0;
+}
+
+// fills a file's chain with a pattern that depends on the cluster, so every copy can be checked.
+// the same bytes go to hostFd as well unless it is -1
+int writeFile(uint32_t first, uint32_t size, int hostFd)
+{
+  uint32_t c = first;
+  uint64_t left = size;
+  while(left > 0 && c >= 2 && c < FAT_END_OF_CHAIN - 8)
+  {
+    for(uint32_t i = 0; i < opt.clusterSize; i += 4)
+    {
+      uint32_t word = c * 2654435761u + i;
+      memcpy(fill + i, &word, 4);
+    }
+    uint64_t run = left < opt.clusterSize ? left : opt.clusterSize;
+    if(writeAll(imageFd, fill, run, dataStart + (uint64_t)(c - 2) * opt.clusterSize) == -1)
+      return -1;
+    if(hostFd != -1 && writeAll(hostFd, fill, run, size - left) == -1)
+      return -1;
+    left -= run;
+    c = fat[c];
+  }
+  return 0;
+}
+
+/*
+ * parameters  : The first cluster of the parent, 0 for the root itself, the level of the new
+ *              directory, 0 being the root, and the host directory that mirrors it or NULL
+ * returns     : The first cluster of the directory, or 0 if the volume ran out of room or the
+ *              host copy could not be written
+ * description : Builds a directory and everything below it. The directory's own chain is
+ *              allocated first so its files and subdirectories end up right behind it on disk,
+ *              the same way a tree copied onto an empty volume would.
+ */
+uint32_t makeDirectory(uint32_t parent, int level, const char *hostDir)
+{
+  int subdirs = level < opt.depth ? opt.fanout : 0;
+  int perFile = opt.longNames ? 3 : 1;
+  uint64_t count = 2 + (uint64_t)opt.files * perFile + subdirs + 1;
+  uint64_t bytes = count * sizeof(struct DirectoryEntry);
+  uint32_t clusters = (bytes + opt.clusterSize - 1) / opt.clusterSize;
+  bytes = (uint64_t)clusters * opt.clusterSize;
+  struct DirectoryEntry *entries = (struct DirectoryEntry *)calloc(1, bytes);
+  uint32_t self = ROOT_CLUSTER;
+  if(level == 0)
+  {
+    // the root already owns cluster 2, any more it needs are linked on behind it
+    if(clusters > 1)
+    {
+      uint32_t rest = allocChain(clusters - 1, 0);
+      if(rest == 0)
+      {
+        free(entries);
+        return 0;
+      }
+      fat[ROOT_CLUSTER] = rest;
+    }
+  }
+  else
+  {
+    self = allocChain(clusters, 0);
+    if(self == 0)
+    {
+      free(entries);
+      return 0;
+    }
+  }
+
+  int n = 0;
+  if(level > 0)
+  {
+    makeEntry(&entries[n++], ".          ", 0x10, self, 0);
+    makeEntry(&entries[n++], "..         ", 0x10, parent == ROOT_CLUSTER ? 0 : parent, 0);
+  }
+  for(int i = 0; i < opt.files; i++)
+  {
+    char name[12];
+    char longName[64];
+    snprintf(name, sizeof(name), "F%07d", i);
+    memcpy(name + 8, "BIN", 3);
+    uint32_t size = opt.minFile;
+    if(opt.maxFile > opt.minFile)
+      size += nextRandom() % (opt.maxFile - opt.minFile + 1);
+    snprintf(longName, sizeof(longName), "File number %d.bin", i);
+    int hostFd = -1;
+    if(hostDir != NULL)
+    {
+      // mfs names a file by its long name if it has one, otherwise as F0000000.BIN
+      char hostPath[4096];
+      if(opt.longNames)
+        snprintf(hostPath, sizeof(hostPath), "%s/%s", hostDir, longName);
+      else
+        snprintf(hostPath, sizeof(hostPath), "%s/F%07d.BIN", hostDir, i);
+      hostFd = open(hostPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if(hostFd == -1)
+      {
+        fprintf(stderr, "Error: Could not create %s: %s\n", hostPath, strerror(errno));
+        free(entries);
+        return 0;
+      }
+    }
+    uint32_t first = 0;
+    if(size > 0)
+      first = allocChain((size + opt.clusterSize - 1) / opt.clusterSize, 1);
+    int failed = size > 0 && (first == 0 || writeFile(first, size, hostFd) == -1);
+    if(hostFd != -1)
+      close(hostFd);
+    if(failed)
+    {
+      free(entries);
+      return 0;
+    }
+    if(opt.longNames)
+      n += makeLongName(&entries[n], longName, name);
+    makeEntry(&entries[n++], name, 0x20, first, size);
+    filesMade++;
+  }
+  for(int i = 0; i < subdirs; i++)
+  {
+    char name[20];
+    snprintf(name, sizeof(name), "DIR%05d   ", i);
+    char hostPath[4096];
+    if(hostDir != NULL)
+    {
+      snprintf(hostPath, sizeof(hostPath), "%s/DIR%05d", hostDir, i);
+      if(mkdir(hostPath, 0755) == -1 && errno != EEXIST)
+      {
+        fprintf(stderr, "Error: Could not create %s: %s\n", hostPath, strerror(errno));
+        free(entries);
+        return 0;
+      }
+    }
+    uint32_t child = makeDirectory(self, level + 1, hostDir != NULL ? hostPath : NULL);
+    if(child == 0)
+    {
+      free(entries);
+      return 0;
+    }
+    makeEntry(&entries[n++], name, 0x10, child, 0);
+  }
+  int ret = writeChain(self, entries, bytes);
+  free(entries);
+  dirsMade++;
+  return ret == -1 ? 0 : self;
+}
+
+// fills in an 8.3 entry, name is the 11 byte on disk form
+void makeEntry(struct DirectoryEntry *e, const char *name, uint8_t attr, uint32_t cluster, uint32_t size)
+{
+  memset(e, 0, sizeof(struct DirectoryEntry));
+  memcpy(e->DIR_Name, name, 11);
+  e->DIR_Attr = attr;
+  e->DIR_FirstClusterHigh = cluster >> 16;
+  e->DIR_FirstClusterLow = cluster & 0xFFFF;
+  e->DIR_FileSize = size;
+  // 2021-01-01 12:00:00
+  e->DIR_CrtDate = e->DIR_WrtDate = e->DIR_LstAccDate = (41 << 9) | (1 << 5) | 1;
+  e->DIR_CrtTime = e->DIR_WrtTime = 12 << 11;
+}
+
+// writes the long name entries for an ASCII long name in front of its 8.3 entry, returns how
+// many there are. the name has to fit in two entries
+int makeLongName(struct DirectoryEntry *entries, const char *longName, const char *shortName)
+{
+  uint16_t chars[26];
+  int length = strlen(longName);
+  for(int i = 0; i < 26; i++)
+    chars[i] = i < length ? (uint8_t)longName[i] : i == length ? 0x0000 : 0xFFFF;
+  int pieces = length < 13 ? 1 : 2;
+  uint8_t checksum = 0;
+  for(int i = 0; i < 11; i++)
+    checksum = ((checksum & 1) << 7) + (checksum >> 1) + (uint8_t)shortName[i];
+  for(int i = 0; i < pieces; i++)
+  {
+    int ordinal = pieces - i;
+    uint8_t *raw = (uint8_t *)&entries[i];
+    uint16_t *part = &chars[(ordinal - 1) * 13];
+    memset(raw, 0, sizeof(struct DirectoryEntry));
+    raw[0] = ordinal | (i == 0 ? 0x40 : 0);
+    memcpy(raw + 1, part, 10);
+    raw[11] = 0x0F;
+    raw[13] = checksum;
+    memcpy(raw + 14, part + 5, 12);
+    memcpy(raw + 28, part + 11, 4);
+  }
+  return pieces;
+}
+
+// writes the boot sector, FSInfo and their backups
+int writeBootSectors(uint32_t fatSize)
+{
+  uint8_t boot[BYTES_PER_SECTOR];
+  uint8_t info[BYTES_PER_SECTOR];
+  uint16_t u16;
+  uint32_t u32;
+  memset(boot, 0, sizeof(boot));
+  memcpy(boot, "\xEB\x58\x90" "MKFAT32 ", 11);
+  u16 = BYTES_PER_SECTOR;
+  memcpy(boot + 11, &u16, 2);
+  boot[13] = opt.clusterSize / BYTES_PER_SECTOR;
+  u16 = RESERVED_SECTORS;
+  memcpy(boot + 14, &u16, 2);
+  boot[16] = NUM_FATS;
+  boot[21] = 0xF8;
+  u16 = 63;
+  memcpy(boot + 24, &u16, 2);
+  u16 = 255;
+  memcpy(boot + 26, &u16, 2);
+  u32 = opt.size / BYTES_PER_SECTOR;
+  memcpy(boot + 32, &u32, 4);
+  memcpy(boot + 36, &fatSize, 4);
+  u32 = ROOT_CLUSTER;
+  memcpy(boot + 44, &u32, 4);
+  u16 = FSINFO_SECTOR;
+  memcpy(boot + 48, &u16, 2);
+  u16 = BACKUP_BOOT_SECTOR;
+  memcpy(boot + 50, &u16, 2);
+  boot[64] = 0x80;
+  boot[66] = 0x29;
+  u32 = opt.seed;
+  memcpy(boot + 67, &u32, 4);
+  memcpy(boot + 71, "MKFAT32    FAT32   ", 19);
+  boot[510] = 0x55;
+  boot[511] = 0xAA;
+
+  memset(info, 0, sizeof(info));
+  u32 = 0x41615252;
+  memcpy(info, &u32, 4);
+  u32 = 0x61417272;
+  memcpy(info + 484, &u32, 4);
+  memcpy(info + 488, &freeClusters, 4);
+  memcpy(info + 492, &nextCluster, 4);
+  u32 = 0xAA550000;
+  memcpy(info + 508, &u32, 4);
+
+  for(int i = 0; i < 2; i++)
+  {
+    off_t base = (off_t)(i == 0 ? 0 : BACKUP_BOOT_SECTOR) * BYTES_PER_SECTOR;
+    if(writeAll(imageFd, boot, sizeof(boot), base) == -1 ||
+       writeAll(imageFd, info, sizeof(info), base + FSINFO_SECTOR * BYTES_PER_SECTOR) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+// pwrite()s the whole buffer, returns -1 on failure
+int writeAll(int fd, const void *buf, size_t len, off_t offset)
+{
+  const uint8_t *p = buf;
+  while(len > 0)
+  {
+    ssize_t n = pwrite(fd, p, len, offset);
+    if(n <= 0)
+      return -1;
+    p += n;
+    offset += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// writes the buffer like writeAll() but skips the chunks that are all zero, the file is fresh
+// from ftruncate() so they read back as zero anyway and take no space on the host
+int writeSparse(int fd, const void *buf, size_t len, off_t offset)
+{
+  const uint8_t *p = buf;
+  for(size_t done = 0; done < len; done += FAT_WRITE_CHUNK)
+  {
+    size_t n = len - done < FAT_WRITE_CHUNK ? len - done : FAT_WRITE_CHUNK;
+    size_t i = 0;
+    while(i < n && p[done + i] == 0)
+      i++;
+    if(i < n && writeAll(fd, p + done, n, offset + done) == -1)
+      return -1;
+  }
+  return 0;
+}
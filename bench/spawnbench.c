@@ -0,0 +1,208 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Trevor Bakker
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+/*
+ * spawnbench times how long it takes to start a command and wait for it, the way msh runs
+ * every command line. The command, /bin/true by default, is launched many times with fork()
+ * and execv(), with vfork() and execv(), and with posix_spawn(). The cost of fork() grows with
+ * the memory of the process that forks, so the batches are repeated with more and more ballast
+ * allocated and touched first, standing in for a shell that has grown large. Each batch runs a
+ * few times and the fastest run counts.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define DEFAULT_LAUNCHES 500    // commands started per batch
+#define DEFAULT_RUNS 3          // timed runs of every batch, the fastest one counts
+#define MAX_SIZES 16            // ballast sizes that can be given with -m
+
+// The ways of starting a command that get compared
+enum Method
+{
+  METHOD_FORK,
+  METHOD_VFORK,
+  METHOD_SPAWN,
+  METHOD_COUNT
+};
+
+const char *methodNames[METHOD_COUNT] = { "fork", "vfork", "posix_spawn" };
+
+void usage(const char *name);
+long parseSize(const char *str);
+double timeBatch(enum Method method, char **argv, int launches);
+pid_t launch(enum Method method, char **argv);
+
+int main(int argc, char *argv[])
+{
+  int launches = DEFAULT_LAUNCHES;
+  int runs = DEFAULT_RUNS;
+  long sizes[MAX_SIZES] = { 0, 64L << 20, 512L << 20 };
+  int sizeCount = 3;
+  int customSizes = 0;
+  int c;
+  while((c = getopt(argc, argv, "n:r:m:")) != -1)
+  {
+    switch(c)
+    {
+      case 'n':
+        launches = atoi(optarg);
+        break;
+      case 'r':
+        runs = atoi(optarg);
+        break;
+      case 'm':
+        // the first -m replaces the default sizes, the ones after it add to the list
+        if(!customSizes)
+          sizeCount = 0;
+        customSizes = 1;
+        if(sizeCount == MAX_SIZES || (sizes[sizeCount++] = parseSize(optarg)) < 0)
+          usage(argv[0]);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if(launches < 1 || runs < 1)
+    usage(argv[0]);
+  char *defaultCommand[] = { "/bin/true", NULL };
+  char **command = optind < argc ? argv + optind : defaultCommand;
+
+  printf("%s: %d launches per batch, fastest of %d runs\n", command[0], launches, runs);
+  printf("%-10s %-12s %10s %10s %10s\n", "ballast", "method", "time ms", "us/launch",
+         "launches/s");
+  char *ballast = NULL;
+  for(int i = 0; i < sizeCount; i++)
+  {
+    // touching every page makes them all part of what fork() has to copy the mappings of
+    free(ballast);
+    ballast = sizes[i] > 0 ? malloc(sizes[i]) : NULL;
+    if(sizes[i] > 0 && ballast == NULL)
+    {
+      fprintf(stderr, "Error: Could not allocate %ld MB of ballast\n", sizes[i] >> 20);
+      return 1;
+    }
+    if(ballast != NULL)
+      memset(ballast, 1, sizes[i]);
+    char label[32];
+    snprintf(label, sizeof(label), "%ld MB", sizes[i] >> 20);
+    for(int method = 0; method < METHOD_COUNT; method++)
+    {
+      double best = -1;
+      for(int run = 0; run < runs; run++)
+      {
+        double t = timeBatch(method, command, launches);
+        if(t < 0)
+        {
+          fprintf(stderr, "Error: Could not run %s with %s\n", command[0], methodNames[method]);
+          return 1;
+        }
+        if(best < 0 || t < best)
+          best = t;
+      }
+      printf("%-10s %-12s %10.2f %10.2f %10.0f\n", label, methodNames[method], best * 1e3,
+             best * 1e6 / launches, launches / best);
+    }
+  }
+  free(ballast);
+  return 0;
+}
+
+void usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-n launches] [-r runs] [-m ballast]... [command [args]]\n"
+          "  -m is a size like 256M to allocate before timing, it can be given more than once\n",
+          name);
+  exit(1);
+}
+
+// turns a size like 512, 64K, 256M or 1G into bytes, -1 if it is not one
+long parseSize(const char *str)
+{
+  char *end;
+  long size = strtol(str, &end, 10);
+  if(end == str || size < 0)
+    return -1;
+  if(*end == 'K' || *end == 'k')
+    size <<= 10;
+  else if(*end == 'M' || *end == 'm')
+    size <<= 20;
+  else if(*end == 'G' || *end == 'g')
+    size <<= 30;
+  else if(*end != '\0')
+    return -1;
+  return size;
+}
+
+// starts the command launches times one after the other, waiting for each, and returns the
+// wall time in seconds, -1 if any of them failed
+double timeBatch(enum Method method, char **argv, int launches)
+{
+  struct timespec start;
+  struct timespec end;
+  int status;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int i = 0; i < launches; i++)
+  {
+    pid_t pid = launch(method, argv);
+    if(pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+       WEXITSTATUS(status) == 127)
+      return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// starts the command one way, returns its pid or -1
+pid_t launch(enum Method method, char **argv)
+{
+  pid_t pid;
+  switch(method)
+  {
+    case METHOD_FORK:
+      pid = fork();
+      if(pid == 0)
+      {
+        execv(argv[0], argv);
+        _exit(127);
+      }
+      return pid;
+    case METHOD_VFORK:
+      // the child borrows the parent's memory until it execs, it may do nothing else
+      pid = vfork();
+      if(pid == 0)
+      {
+        execv(argv[0], argv);
+        _exit(127);
+      }
+      return pid;
+    default:
+      return posix_spawn(&pid, argv[0], NULL, NULL, argv, environ) == 0 ? pid : -1;
+  }
+}
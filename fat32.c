@@ -0,0 +1,1326 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Trevor Bakker
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "fat32.h"
+
+#define FAT_PAGE_ENTRIES 16384  // Number of FAT entries that get loaded into memory at a time
+
+#define FSINFO_LEAD_SIG 0x41615252  // Signatures that mark a valid FSInfo sector
+#define FSINFO_STRUC_SIG 0x61417272
+
+#define MAX_LONG_PARTS 20       // Long name entries a single name can be spread over
+
+#define CACHE_BATCH 64          // Most missing frames read in with a single preadv()
+
+#define FRAME_FREE 0            // States of a cache frame
+#define FRAME_LOADING 1
+#define FRAME_VALID 2
+
+// One cluster sized frame of the block cache
+struct CacheFrame
+{
+  int64_t block;                // block of the image held, block b starts at b * size - shift
+  int next;                     // next frame in the same hash bucket, -1 ends the chain
+  uint8_t state;                // FRAME_FREE, FRAME_LOADING or FRAME_VALID
+  uint8_t referenced;           // set on every hit, cleared as the clock hand passes
+};
+
+// Cluster sized blocks of the image kept in memory, evicted with the CLOCK algorithm. Blocks
+// are lined up with the clusters of the data area, so a cluster always sits in one frame
+struct BlockCache
+{
+  pthread_mutex_t lock;         // protects everything below but the frame contents, a frame
+                                // being loaded is only written by the thread loading it
+  pthread_cond_t loaded;        // broadcast whenever frames finish loading
+  uint32_t blockSize;           // bytes per frame, the cluster size
+  uint32_t shift;               // bytes block 0 starts before the image does
+  uint8_t *memory;              // frameCount frames of blockSize bytes
+  struct CacheFrame *frames;
+  int frameCount;
+  int used;                     // frames holding a block or loading one
+  int fresh;                    // frames from here on have never been used
+  int *buckets;                 // heads of the hash chains, -1 when empty
+  uint32_t bucketMask;
+  int hand;                     // next frame the clock hand looks at
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+};
+
+// I/O counters of a volume, bumped atomically by whichever thread does the I/O
+struct IoStats
+{
+  uint64_t reads;
+  uint64_t bytesRead;
+  uint64_t seeks;
+  uint64_t writes;
+  uint64_t bytesWritten;
+  uint64_t fatLookups;
+  off_t lastEnd;                // where the last read ended, a read starting elsewhere seeked
+};
+
+struct Fat32Volume
+{
+  int fd;                       // descriptor of the image, only ever used with pread/pwrite
+  int writable;                 // 1 when the image was opened for writing
+  off_t size;                   // size of the image in bytes
+  struct Fat32Info info;
+  uint32_t **fatPages;          // pages of the first FAT, a NULL page has not been loaded yet
+  uint32_t *fatDirty;           // per page span of changed entries, first and one past last,
+                                // a span ending at 0 is clean
+  struct BlockCache cache;
+  struct IoStats io;
+};
+
+struct Fat32Dir
+{
+  Fat32Volume *volume;
+  uint32_t cluster;             // first cluster of the directory
+  struct Fat32DirEntry *entries; // every entry up to the end of directory marker
+  int count;
+  char **longNames;             // UTF-8 long name of each entry, NULL if it has none
+  int next;                     // where fat32ReadDir() continues
+};
+
+struct Fat32File
+{
+  Fat32Volume *volume;
+  struct Fat32ExtentMap map;
+  uint32_t size;
+};
+
+static int readInfo(Fat32Volume *v, const uint8_t *boot);
+static void fillEntry(Fat32Dir *d, int index, struct Fat32Entry *entry);
+static void cacheFree(struct BlockCache *c);
+static uint32_t bucketOf(struct BlockCache *c, int64_t block);
+static int cacheFind(struct BlockCache *c, int64_t block);
+static void cacheRemove(struct BlockCache *c, int frame);
+static int cacheVictim(struct BlockCache *c);
+static int cacheLoad(Fat32Volume *v, int64_t first, int count, int *frames);
+static void blockRange(Fat32Volume *v, int64_t block, off_t *start, off_t *end);
+
+/*
+ * parameters  : The path of an image and 1 to open it for writing when permissions allow
+ * returns     : A new volume, or NULL if the image could not be opened or is too small. errno is
+ *              EINVAL when the boot sector does not describe a usable FAT32 volume
+ * description : Opens the image and reads its boot sector. The FAT is not read yet, its pages
+ *              come in the first time an entry inside of them is looked up.
+ */
+Fat32Volume *fat32Open(const char *path, int writable)
+{
+  int fd = -1;
+  if(writable)
+    fd = open(path, O_RDWR);
+  if(fd == -1)
+  {
+    writable = 0;
+    fd = open(path, O_RDONLY);
+  }
+  if(fd == -1)
+    return NULL;
+  struct stat st;
+  uint8_t boot[512];
+  ssize_t got = fstat(fd, &st) == -1 ? -1 : pread(fd, boot, sizeof(boot), 0);
+  if(got == -1)
+  {
+    int error = errno;
+    close(fd);
+    errno = error;
+    return NULL;
+  }
+  // an image too small to hold a boot sector is not a FAT32 volume either
+  if(st.st_size < 512 || got != sizeof(boot))
+  {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  Fat32Volume *v = (Fat32Volume *)calloc(1, sizeof(Fat32Volume));
+  v->fd = fd;
+  v->writable = writable;
+  v->size = st.st_size;
+  if(readInfo(v, boot) == -1)
+  {
+    close(fd);
+    free(v);
+    errno = EINVAL;
+    return NULL;
+  }
+  fat32CountRead(v, 0, sizeof(boot));
+  uint32_t pages = (v->info.fatEntries + FAT_PAGE_ENTRIES - 1) / FAT_PAGE_ENTRIES;
+  v->fatPages = (uint32_t **)calloc(pages + 1, sizeof(uint32_t *));
+  pthread_mutex_init(&v->cache.lock, NULL);
+  pthread_cond_init(&v->cache.loaded, NULL);
+  fat32SetCacheSize(v, FAT32_DEFAULT_CACHE_SIZE);
+  return v;
+}
+
+// copies the boot sector fields and works out the layout of the volume from them. returns -1
+// if the fields can not belong to a FAT32 volume, so nothing after this has to divide by zero
+static int readInfo(Fat32Volume *v, const uint8_t *boot)
+{
+  struct Fat32Info *info = &v->info;
+  memcpy(&info->BPB_BytsPerSec, boot + 11, 2);
+  memcpy(&info->BPB_SecPerClus, boot + 13, 1);
+  memcpy(&info->BPB_RsvdSecCnt, boot + 14, 2);
+  memcpy(&info->BPB_NumFATs, boot + 16, 1);
+  memcpy(&info->BPB_FATSz32, boot + 36, 4);
+  memcpy(&info->BPB_RootClus, boot + 44, 4);
+  memcpy(&info->BPB_TotSec32, boot + 32, 4);
+  memcpy(&info->BPB_FSInfo, boot + 48, 2);
+  uint16_t bytes = info->BPB_BytsPerSec;
+  uint8_t perCluster = info->BPB_SecPerClus;
+  if(bytes < 512 || bytes > 4096 || (bytes & (bytes - 1)) != 0 || perCluster == 0 ||
+     (perCluster & (perCluster - 1)) != 0 || info->BPB_NumFATs == 0 || info->BPB_FATSz32 == 0)
+    return -1;
+
+  info->fatEntries = (uint32_t)(((uint64_t)info->BPB_FATSz32 * info->BPB_BytsPerSec) / 4);
+  info->clusterSize = (uint32_t)info->BPB_BytsPerSec * info->BPB_SecPerClus;
+  info->fatStart = (off_t)info->BPB_RsvdSecCnt * info->BPB_BytsPerSec;
+  info->fatSize = (off_t)info->BPB_FATSz32 * info->BPB_BytsPerSec;
+  info->dataStart = info->fatStart + info->BPB_NumFATs * info->fatSize;
+  uint64_t dataSector = info->BPB_RsvdSecCnt + (uint64_t)info->BPB_NumFATs * info->BPB_FATSz32;
+  info->clusterCount = info->BPB_TotSec32 > dataSector && info->BPB_SecPerClus ?
+                       (info->BPB_TotSec32 - dataSector) / info->BPB_SecPerClus : 0;
+  // the FAT can not describe more clusters than it has entries for
+  if(info->fatEntries < 2)
+    info->clusterCount = 0;
+  else if(info->clusterCount > info->fatEntries - 2)
+    info->clusterCount = info->fatEntries - 2;
+  if(info->BPB_RootClus < 2 || info->BPB_RootClus >= (uint64_t)info->clusterCount + 2)
+    return -1;
+  return 0;
+}
+
+// releases the FAT pages and closes the image. changes that were never flushed are lost
+void fat32Close(Fat32Volume *v)
+{
+  if(v == NULL)
+    return;
+  uint32_t pages = (v->info.fatEntries + FAT_PAGE_ENTRIES - 1) / FAT_PAGE_ENTRIES;
+  for(uint32_t i = 0; i < pages; i++)
+    free(v->fatPages[i]);
+  free(v->fatPages);
+  free(v->fatDirty);
+  cacheFree(&v->cache);
+  pthread_mutex_destroy(&v->cache.lock);
+  pthread_cond_destroy(&v->cache.loaded);
+  close(v->fd);
+  free(v);
+}
+
+const struct Fat32Info *fat32GetInfo(const Fat32Volume *v)
+{
+  return &v->info;
+}
+
+// the image descriptor, for callers that want to hand ranges of it to the kernel themselves.
+// it must only be used with positioned calls
+int fat32Descriptor(const Fat32Volume *v)
+{
+  return v->fd;
+}
+
+int fat32Writable(const Fat32Volume *v)
+{
+  return v->writable;
+}
+
+off_t fat32ImageSize(const Fat32Volume *v)
+{
+  return v->size;
+}
+
+/*
+ * parameters  : The volume, a destination buffer, an offset into the image and a length
+ * returns     : 0 on success, -1 if the range is outside of the image or reading failed
+ * description : Copies a range of the image into dst through the block cache. Blocks that are
+ *              not cached yet are read in with one preadv() per run of them. A range covering
+ *              more than a quarter of the cache is read with fat32ReadDirect() instead, so one
+ *              big read can not push out everything else. Any number of threads can read at
+ *              once.
+ */
+int fat32Read(Fat32Volume *v, void *dst, off_t offset, size_t len)
+{
+  struct BlockCache *c = &v->cache;
+  uint8_t *out = dst;
+  if(offset < 0 || offset > v->size || len > (uint64_t)(v->size - offset))
+    return -1;
+  if(len == 0)
+    return 0;
+  int64_t first = (offset + c->shift) / c->blockSize;
+  int64_t last = (offset + (off_t)len - 1 + c->shift) / c->blockSize;
+  if(c->frameCount == 0 || last - first + 1 > c->frameCount / 4)
+    return fat32ReadDirect(v, dst, offset, len);
+
+  int ret = 0;
+  int64_t fetched = first;      // blocks below this one were read in by this call, not hits
+  pthread_mutex_lock(&c->lock);
+  for(int64_t block = first; block <= last && ret == 0;)
+  {
+    int frame = cacheFind(c, block);
+    if(frame != -1 && c->frames[frame].state == FRAME_LOADING)
+    {
+      pthread_cond_wait(&c->loaded, &c->lock);
+      continue;
+    }
+    if(frame == -1)
+    {
+      // claim frames for the run of missing blocks starting here and read them in together
+      int frames[CACHE_BATCH];
+      int count = 0;
+      while(count < CACHE_BATCH && block + count <= last && cacheFind(c, block + count) == -1)
+      {
+        int frame = cacheVictim(c);
+        if(frame == -1)
+          break;
+        struct CacheFrame *f = &c->frames[frame];
+        uint32_t bucket = bucketOf(c, block + count);
+        f->block = block + count;
+        f->state = FRAME_LOADING;
+        f->referenced = 1;
+        f->next = c->buckets[bucket];
+        c->buckets[bucket] = frame;
+        frames[count++] = frame;
+      }
+      if(count == 0)
+      {
+        // every frame is being loaded by someone else, wait for one to free up
+        pthread_cond_wait(&c->loaded, &c->lock);
+        continue;
+      }
+      c->misses += count;
+      pthread_mutex_unlock(&c->lock);
+      int failed = cacheLoad(v, block, count, frames);
+      pthread_mutex_lock(&c->lock);
+      for(int i = 0; i < count; i++)
+      {
+        if(failed)
+          cacheRemove(c, frames[i]);
+        else
+          c->frames[frames[i]].state = FRAME_VALID;
+      }
+      pthread_cond_broadcast(&c->loaded);
+      if(failed)
+        ret = -1;
+      fetched = block + count;
+      continue;
+    }
+    if(block >= fetched)
+      c->hits++;
+    c->frames[frame].referenced = 1;
+    off_t start;
+    off_t end;
+    blockRange(v, block, &start, &end);
+    off_t from = offset > start ? offset : start;
+    off_t to = offset + (off_t)len < end ? offset + (off_t)len : end;
+    memcpy(out + (from - offset), c->memory + (size_t)frame * c->blockSize + (from - start), to - from);
+    block++;
+  }
+  pthread_mutex_unlock(&c->lock);
+  return ret;
+}
+
+// reads a range of the image with pread() alone, leaving the block cache as it is. meant for
+// bulk data that is only looked at once. returns 0 on success and -1 on failure
+int fat32ReadDirect(Fat32Volume *v, void *dst, off_t offset, size_t len)
+{
+  uint8_t *out = dst;
+  if(offset < 0 || offset > v->size || len > (uint64_t)(v->size - offset))
+    return -1;
+  while(len > 0)
+  {
+    ssize_t n = pread(v->fd, out, len, offset);
+    if(n <= 0)
+      return -1;
+    fat32CountRead(v, offset, n);
+    out += n;
+    offset += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// the part of the image block covers, from start up to end. the first and last block are cut
+// short by the ends of the image
+static void blockRange(Fat32Volume *v, int64_t block, off_t *start, off_t *end)
+{
+  *start = block * v->cache.blockSize - v->cache.shift;
+  *end = *start + v->cache.blockSize;
+  if(*start < 0)
+    *start = 0;
+  if(*end > v->size)
+    *end = v->size;
+}
+
+// reads count consecutive blocks starting at first into the given frames with one preadv().
+// called without the cache lock, the frames are marked as loading so nobody else touches them.
+// returns 0 on success and -1 on failure
+static int cacheLoad(Fat32Volume *v, int64_t first, int count, int *frames)
+{
+  struct BlockCache *c = &v->cache;
+  struct iovec iov[CACHE_BATCH];
+  off_t offset;
+  off_t end;
+  blockRange(v, first, &offset, &end);
+  size_t total = 0;
+  for(int i = 0; i < count; i++)
+  {
+    off_t start;
+    blockRange(v, first + i, &start, &end);
+    iov[i].iov_base = c->memory + (size_t)frames[i] * c->blockSize;
+    iov[i].iov_len = end - start;
+    total += end - start;
+  }
+  int next = 0;
+  while(total > 0)
+  {
+    ssize_t n = preadv(v->fd, iov + next, count - next, offset);
+    if(n <= 0)
+      return -1;
+    fat32CountRead(v, offset, n);
+    offset += n;
+    total -= n;
+    // a short read carries on where it stopped
+    while(next < count && (size_t)n >= iov[next].iov_len)
+      n -= iov[next++].iov_len;
+    if(next < count)
+    {
+      iov[next].iov_base = (uint8_t *)iov[next].iov_base + n;
+      iov[next].iov_len -= n;
+    }
+  }
+  return 0;
+}
+
+// the hash chain a block goes into, multiplicative hashing spreads neighbouring blocks out
+static uint32_t bucketOf(struct BlockCache *c, int64_t block)
+{
+  return (uint32_t)(((uint64_t)block * 0x9E3779B97F4A7C15ULL) >> 32) & c->bucketMask;
+}
+
+// returns the frame holding block, or -1 if it is not cached. needs the cache lock
+static int cacheFind(struct BlockCache *c, int64_t block)
+{
+  int frame = c->buckets[bucketOf(c, block)];
+  while(frame != -1 && c->frames[frame].block != block)
+    frame = c->frames[frame].next;
+  return frame;
+}
+
+// unlinks a frame from its hash chain and marks it free. needs the cache lock
+static void cacheRemove(struct BlockCache *c, int frame)
+{
+  struct CacheFrame *f = &c->frames[frame];
+  if(f->state == FRAME_FREE)
+    return;
+  int *link = &c->buckets[bucketOf(c, f->block)];
+  while(*link != frame)
+    link = &c->frames[*link].next;
+  *link = f->next;
+  f->state = FRAME_FREE;
+  f->next = -1;
+  c->used--;
+}
+
+/*
+ * returns     : A free frame, or -1 if every frame is being loaded
+ * description : Hands out the frames that were never used first, then runs the clock hand
+ *              around the frames. A frame that was used since the hand last passed gets another
+ *              round, the first one that was not is evicted. Needs the cache lock.
+ */
+static int cacheVictim(struct BlockCache *c)
+{
+  if(c->fresh < c->frameCount)
+  {
+    c->used++;
+    return c->fresh++;
+  }
+  // two full turns clear every reference bit, anything still not taken is loading
+  for(int i = 0; i < c->frameCount * 2; i++)
+  {
+    int frame = c->hand;
+    struct CacheFrame *f = &c->frames[frame];
+    c->hand = (c->hand + 1) % c->frameCount;
+    if(f->state == FRAME_LOADING)
+      continue;
+    if(f->state == FRAME_VALID)
+    {
+      if(f->referenced)
+      {
+        f->referenced = 0;
+        continue;
+      }
+      cacheRemove(c, frame);
+      c->evictions++;
+    }
+    c->used++;
+    return frame;
+  }
+  return -1;
+}
+
+/*
+ * parameters  : The volume and the most memory the block cache may use, 0 turns it off
+ * returns     : 0 on success, -1 if the memory could not be had, which leaves the cache off
+ * description : Drops everything cached and sets the cache up again with as many cluster sized
+ *              frames as fit in bytes. The counters start over. Must not run alongside reads.
+ */
+int fat32SetCacheSize(Fat32Volume *v, size_t bytes)
+{
+  struct BlockCache *c = &v->cache;
+  cacheFree(c);
+  c->blockSize = v->info.clusterSize ? v->info.clusterSize : 512;
+  c->shift = (c->blockSize - v->info.dataStart % c->blockSize) % c->blockSize;
+  c->frameCount = bytes / c->blockSize;
+  if(c->frameCount == 0)
+    return 0;
+  uint32_t buckets = 16;
+  while(buckets < (uint32_t)c->frameCount * 2)
+    buckets *= 2;
+  c->memory = (uint8_t *)malloc((size_t)c->frameCount * c->blockSize);
+  c->frames = (struct CacheFrame *)calloc(c->frameCount, sizeof(struct CacheFrame));
+  c->buckets = (int *)malloc(sizeof(int) * buckets);
+  if(c->memory == NULL || c->frames == NULL || c->buckets == NULL)
+  {
+    cacheFree(c);
+    return -1;
+  }
+  for(int i = 0; i < c->frameCount; i++)
+    c->frames[i].next = -1;
+  memset(c->buckets, -1, sizeof(int) * buckets);
+  c->bucketMask = buckets - 1;
+  return 0;
+}
+
+// releases the frames of the cache and zeroes its counters
+static void cacheFree(struct BlockCache *c)
+{
+  free(c->memory);
+  free(c->frames);
+  free(c->buckets);
+  c->memory = NULL;
+  c->frames = NULL;
+  c->buckets = NULL;
+  c->frameCount = 0;
+  c->used = 0;
+  c->fresh = 0;
+  c->hand = 0;
+  c->hits = 0;
+  c->misses = 0;
+  c->evictions = 0;
+}
+
+// copies the block cache counters into stats
+void fat32GetCacheStats(Fat32Volume *v, struct Fat32CacheStats *stats)
+{
+  struct BlockCache *c = &v->cache;
+  pthread_mutex_lock(&c->lock);
+  stats->hits = c->hits;
+  stats->misses = c->misses;
+  stats->evictions = c->evictions;
+  stats->frames = c->frameCount;
+  stats->used = c->used;
+  stats->frameSize = c->blockSize;
+  pthread_mutex_unlock(&c->lock);
+}
+
+void fat32ResetCacheStats(Fat32Volume *v)
+{
+  struct BlockCache *c = &v->cache;
+  pthread_mutex_lock(&c->lock);
+  c->hits = 0;
+  c->misses = 0;
+  c->evictions = 0;
+  pthread_mutex_unlock(&c->lock);
+}
+
+// copies the I/O counters into stats
+void fat32GetIoStats(Fat32Volume *v, struct Fat32IoStats *stats)
+{
+  stats->reads = __atomic_load_n(&v->io.reads, __ATOMIC_RELAXED);
+  stats->bytesRead = __atomic_load_n(&v->io.bytesRead, __ATOMIC_RELAXED);
+  stats->seeks = __atomic_load_n(&v->io.seeks, __ATOMIC_RELAXED);
+  stats->writes = __atomic_load_n(&v->io.writes, __ATOMIC_RELAXED);
+  stats->bytesWritten = __atomic_load_n(&v->io.bytesWritten, __ATOMIC_RELAXED);
+  stats->fatLookups = __atomic_load_n(&v->io.fatLookups, __ATOMIC_RELAXED);
+}
+
+// counts one read of len bytes at offset. the library counts its own, callers that read the
+// descriptor themselves report theirs here so the totals stay complete
+void fat32CountRead(Fat32Volume *v, off_t offset, size_t len)
+{
+  __atomic_fetch_add(&v->io.reads, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&v->io.bytesRead, len, __ATOMIC_RELAXED);
+  if(__atomic_exchange_n(&v->io.lastEnd, offset + (off_t)len, __ATOMIC_RELAXED) != offset)
+    __atomic_fetch_add(&v->io.seeks, 1, __ATOMIC_RELAXED);
+}
+
+// the fat32CountRead() of writes
+void fat32CountWrite(Fat32Volume *v, size_t len)
+{
+  __atomic_fetch_add(&v->io.writes, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&v->io.bytesWritten, len, __ATOMIC_RELAXED);
+}
+
+// drops every cached block overlapping the range, for callers that wrote to the image without
+// going through fat32Write()
+void fat32Invalidate(Fat32Volume *v, off_t offset, size_t len)
+{
+  struct BlockCache *c = &v->cache;
+  if(c->frameCount == 0 || len == 0)
+    return;
+  int64_t first = (offset + c->shift) / c->blockSize;
+  int64_t last = (offset + (off_t)len - 1 + c->shift) / c->blockSize;
+  pthread_mutex_lock(&c->lock);
+  // a long range is cheaper to check frame by frame than block by block
+  if(last - first >= c->frameCount)
+  {
+    for(int i = 0; i < c->frameCount; i++)
+    {
+      struct CacheFrame *f = &c->frames[i];
+      if(f->state == FRAME_VALID && f->block >= first && f->block <= last)
+        cacheRemove(c, i);
+    }
+  }
+  else
+  {
+    for(int64_t block = first; block <= last; block++)
+    {
+      int frame = cacheFind(c, block);
+      if(frame != -1 && c->frames[frame].state == FRAME_VALID)
+        cacheRemove(c, frame);
+    }
+  }
+  pthread_mutex_unlock(&c->lock);
+}
+
+// writes a range of the image, returns 0 on success and -1 on failure. cached blocks the range
+// touches are dropped
+int fat32Write(Fat32Volume *v, const void *src, off_t offset, size_t len)
+{
+  const uint8_t *in = src;
+  if(!v->writable)
+    return -1;
+  fat32Invalidate(v, offset, len);
+  while(len > 0)
+  {
+    ssize_t n = pwrite(v->fd, in, len, offset);
+    if(n <= 0)
+      return -1;
+    fat32CountWrite(v, n);
+    in += n;
+    offset += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// the byte offset of a data cluster in the image. cluster 0, which an empty file or a ".."
+// pointing at the root holds, gives the start of the data area
+off_t fat32ClusterOffset(const Fat32Volume *v, uint32_t cluster)
+{
+  if(cluster < 2)
+    cluster = 2;
+  return v->info.dataStart + (off_t)(cluster - 2) * v->info.clusterSize;
+}
+
+/*
+ * parameters  : The volume and a cluster number
+ * returns     : The 28 bit FAT entry of that cluster, or FAT32_ENTRY_MASK (end of chain) if
+ *              the cluster is outside of the FAT
+ * description : Looks the cluster up in the in memory FAT. The page holding the entry is read
+ *              from the image and masked the first time it is needed, after that every lookup
+ *              is a plain array access. Safe to call from several threads.
+ */
+uint32_t fat32Entry(Fat32Volume *v, uint32_t cluster)
+{
+  __atomic_fetch_add(&v->io.fatLookups, 1, __ATOMIC_RELAXED);
+  if(cluster >= v->info.fatEntries)
+    return FAT32_ENTRY_MASK;
+  uint32_t *page = __atomic_load_n(&v->fatPages[cluster / FAT_PAGE_ENTRIES], __ATOMIC_ACQUIRE);
+  if(page == NULL)
+  {
+    uint32_t first = cluster - (cluster % FAT_PAGE_ENTRIES);
+    uint32_t count = v->info.fatEntries - first < FAT_PAGE_ENTRIES ?
+                     v->info.fatEntries - first : FAT_PAGE_ENTRIES;
+    page = (uint32_t *)malloc(sizeof(uint32_t) * FAT_PAGE_ENTRIES);
+    // the pages are a cache of their own, going through the block cache would keep them twice
+    if(fat32ReadDirect(v, page, v->info.fatStart + (off_t)first * 4, count * 4) == -1)
+    {
+      free(page);
+      return FAT32_ENTRY_MASK;
+    }
+    for(uint32_t i = 0; i < count; i++)
+      page[i] &= FAT32_ENTRY_MASK;
+    // threads may race to load the same page, the first one to publish it wins
+    uint32_t *expected = NULL;
+    if(!__atomic_compare_exchange_n(&v->fatPages[cluster / FAT_PAGE_ENTRIES], &expected, page, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+      free(page);
+      page = expected;
+    }
+  }
+  return page[cluster % FAT_PAGE_ENTRIES];
+}
+
+// returns the cluster after this one in its chain, or 0 when the chain ends here. free,
+// reserved, bad and end of chain entries all mean there is no next cluster
+uint32_t fat32Next(Fat32Volume *v, uint32_t cluster)
+{
+  uint32_t value = fat32Entry(v, cluster);
+  if(value < 2 || value >= FAT32_BAD_CLUSTER)
+    return 0;
+  return value;
+}
+
+/*
+ * parameters  : The volume, a cluster number and the value its FAT entry should get
+ * description : Changes the entry in the in memory FAT and remembers the span of changed
+ *              entries in its page. Nothing reaches the image until fat32Flush().
+ */
+void fat32SetEntry(Fat32Volume *v, uint32_t cluster, uint32_t value)
+{
+  if(cluster >= v->info.fatEntries)
+    return;
+  fat32Entry(v, cluster);
+  uint32_t *page = v->fatPages[cluster / FAT_PAGE_ENTRIES];
+  if(page == NULL)
+    return;
+  page[cluster % FAT_PAGE_ENTRIES] = value & FAT32_ENTRY_MASK;
+  if(v->fatDirty == NULL)
+  {
+    uint32_t pages = (v->info.fatEntries + FAT_PAGE_ENTRIES - 1) / FAT_PAGE_ENTRIES;
+    v->fatDirty = (uint32_t *)calloc(pages * 2, sizeof(uint32_t));
+  }
+  uint32_t *span = &v->fatDirty[(cluster / FAT_PAGE_ENTRIES) * 2];
+  if(span[1] == 0 || cluster < span[0])
+    span[0] = cluster;
+  if(cluster + 1 > span[1])
+    span[1] = cluster + 1;
+}
+
+/*
+ * returns     : 0 on success, -1 if a write failed
+ * description : Writes the changed span of every page to every FAT copy, one write per page
+ *              and copy. The top 4 bits of each entry are reserved, so they are taken from what
+ *              the first FAT holds on disk.
+ */
+int fat32Flush(Fat32Volume *v)
+{
+  int ret = 0;
+  uint32_t pages = (v->info.fatEntries + FAT_PAGE_ENTRIES - 1) / FAT_PAGE_ENTRIES;
+  uint32_t *raw = (uint32_t *)malloc(sizeof(uint32_t) * FAT_PAGE_ENTRIES);
+  for(uint32_t p = 0; v->fatDirty != NULL && p < pages; p++)
+  {
+    uint32_t first = v->fatDirty[p * 2];
+    uint32_t end = v->fatDirty[p * 2 + 1];
+    if(end == 0)
+      continue;
+    v->fatDirty[p * 2 + 1] = 0;
+    uint32_t count = end - first;
+    if(fat32ReadDirect(v, raw, v->info.fatStart + (off_t)first * 4, count * 4) == -1)
+    {
+      ret = -1;
+      continue;
+    }
+    for(uint32_t i = 0; i < count; i++)
+      raw[i] = (raw[i] & ~FAT32_ENTRY_MASK) | v->fatPages[p][first % FAT_PAGE_ENTRIES + i];
+    for(int copy = 0; copy < v->info.BPB_NumFATs; copy++)
+    {
+      off_t offset = v->info.fatStart + copy * v->info.fatSize + (off_t)first * 4;
+      if(fat32Write(v, raw, offset, count * 4) == -1)
+        ret = -1;
+    }
+  }
+  free(raw);
+  return ret;
+}
+
+/*
+ * parameters  : Where to store the free cluster count and the next free cluster hint
+ * returns     : 0 if the FSInfo sector carries valid signatures, -1 otherwise
+ * description : Reads the two hints FSInfo keeps. Either may still be FAT32_FSINFO_UNKNOWN.
+ */
+int fat32ReadFSInfo(Fat32Volume *v, uint32_t *freeCount, uint32_t *nextFree)
+{
+  uint32_t sector[128];
+  if(v->info.BPB_FSInfo == 0 ||
+     fat32Read(v, sector, (off_t)v->info.BPB_FSInfo * v->info.BPB_BytsPerSec, sizeof(sector)) == -1)
+    return -1;
+  *freeCount = sector[122];
+  *nextFree = sector[123];
+  return sector[0] == FSINFO_LEAD_SIG && sector[121] == FSINFO_STRUC_SIG ? 0 : -1;
+}
+
+// stores both FSInfo hints, provided the sector is a valid FSInfo sector to begin with.
+// returns 0 on success, -1 if there is no FSInfo or the write failed
+int fat32WriteFSInfo(Fat32Volume *v, uint32_t freeCount, uint32_t nextFree)
+{
+  uint32_t oldFree;
+  uint32_t oldNext;
+  uint32_t hints[2] = { freeCount, nextFree };
+  if(fat32ReadFSInfo(v, &oldFree, &oldNext) == -1)
+    return -1;
+  off_t sector = (off_t)v->info.BPB_FSInfo * v->info.BPB_BytsPerSec;
+  return fat32Write(v, hints, sector + 488, sizeof(hints));
+}
+
+/*
+ * parameters  : The volume, the first cluster of a chain and the map to fill in
+ * description : Walks the chain once and collapses clusters that follow each other on disk
+ *              into a single extent. A first cluster below 2 (empty file) gives a map without
+ *              extents. The map belongs to the caller, so any number of threads can build maps
+ *              at once.
+ */
+void fat32BuildExtents(Fat32Volume *v, uint32_t firstCluster, struct Fat32ExtentMap *map)
+{
+  memset(map, 0, sizeof(struct Fat32ExtentMap));
+  int capacity = 8;
+  map->extents = (struct Fat32Extent *)malloc(sizeof(struct Fat32Extent) * capacity);
+  if(firstCluster < 2)
+    return;
+  map->firstCluster = firstCluster;
+
+  uint32_t cluster = firstCluster;
+  // a chain can never be longer than the FAT, stopping there keeps a looping chain from hanging
+  while(cluster != 0 && map->clusters < v->info.fatEntries)
+  {
+    struct Fat32Extent *last = map->count ? &map->extents[map->count - 1] : NULL;
+    if(last != NULL && last->diskCluster + last->count == cluster)
+    {
+      last->count++;
+    }
+    else
+    {
+      if(map->count == capacity)
+      {
+        capacity *= 2;
+        map->extents = (struct Fat32Extent *)realloc(map->extents,
+                                                     sizeof(struct Fat32Extent) * capacity);
+      }
+      map->extents[map->count].fileCluster = map->clusters;
+      map->extents[map->count].diskCluster = cluster;
+      map->extents[map->count].count = 1;
+      map->count++;
+    }
+    map->clusters++;
+    cluster = fat32Next(v, cluster);
+  }
+}
+
+// returns the index of the extent holding the given cluster of the file, or -1 if the chain
+// is shorter than that. a binary search, the extents are sorted by fileCluster
+int fat32FindExtent(const struct Fat32ExtentMap *map, uint32_t fileCluster)
+{
+  int low = 0;
+  int high = map->count - 1;
+  while(low <= high)
+  {
+    int mid = low + (high - low) / 2;
+    const struct Fat32Extent *e = &map->extents[mid];
+    if(fileCluster < e->fileCluster)
+      high = mid - 1;
+    else if(fileCluster >= e->fileCluster + e->count)
+      low = mid + 1;
+    else
+      return mid;
+  }
+  return -1;
+}
+
+/*
+ * parameters  : The volume, an extent map, a destination buffer, a byte position in the file
+ *              and a length
+ * returns     : The number of bytes copied, which is less than len if the chain ends early
+ * description : Copies file data starting at pos. The extent holding pos is found with a binary
+ *              search and every following extent is copied with one contiguous read.
+ */
+int64_t fat32ExtentRead(Fat32Volume *v, const struct Fat32ExtentMap *map, void *dst, int64_t pos,
+                        int64_t len)
+{
+  uint8_t *out = dst;
+  int64_t done = 0;
+  uint32_t clusterSize = v->info.clusterSize;
+  int i = fat32FindExtent(map, pos / clusterSize);
+  while(i != -1 && i < map->count && done < len)
+  {
+    const struct Fat32Extent *e = &map->extents[i];
+    int64_t inExtent = pos - (int64_t)e->fileCluster * clusterSize;
+    int64_t run = (int64_t)e->count * clusterSize - inExtent;
+    if(run > len - done)
+      run = len - done;
+    if(fat32Read(v, out + done, fat32ClusterOffset(v, e->diskCluster) + inExtent, run) == -1)
+      break;
+    done += run;
+    pos += run;
+    i++;
+  }
+  return done;
+}
+
+// the counterpart of fat32ExtentRead(), writes len bytes at file position pos. returns how many
+// bytes were written, which is short if the chain ends first or a write fails
+int64_t fat32ExtentWrite(Fat32Volume *v, const struct Fat32ExtentMap *map, const void *src,
+                         int64_t pos, int64_t len)
+{
+  const uint8_t *in = src;
+  int64_t done = 0;
+  uint32_t clusterSize = v->info.clusterSize;
+  int i = fat32FindExtent(map, pos / clusterSize);
+  while(i != -1 && i < map->count && done < len)
+  {
+    const struct Fat32Extent *e = &map->extents[i];
+    int64_t inExtent = pos - (int64_t)e->fileCluster * clusterSize;
+    int64_t run = (int64_t)e->count * clusterSize - inExtent;
+    if(run > len - done)
+      run = len - done;
+    if(fat32Write(v, in + done, fat32ClusterOffset(v, e->diskCluster) + inExtent, run) == -1)
+      break;
+    done += run;
+    pos += run;
+    i++;
+  }
+  return done;
+}
+
+/*
+ * parameters  : The volume and the first cluster of a directory, 0 meaning the root directory
+ * returns     : The directory, or NULL if it could not be read
+ * description : Reads every cluster of the directory's chain, stopping at the first end of
+ *              directory marker, and puts the long names back together. Long names are stored
+ *              as a run of 0x0F entries in front of the 8.3 entry they belong to, the highest
+ *              ordinal first and each carrying 13 UCS-2 characters. The run is only used if
+ *              its ordinals count down to 1 and its checksum matches the 8.3 name.
+ */
+Fat32Dir *fat32OpenDir(Fat32Volume *v, uint32_t cluster)
+{
+  // ".." entries of directories right below the root point at cluster 0
+  if(cluster == 0)
+    cluster = v->info.BPB_RootClus;
+  struct Fat32ExtentMap map;
+  fat32BuildExtents(v, cluster, &map);
+  int64_t bytes = (int64_t)map.clusters * v->info.clusterSize;
+  int entries = bytes / sizeof(struct Fat32DirEntry);
+  if(entries == 0)
+  {
+    free(map.extents);
+    return NULL;
+  }
+  Fat32Dir *d = (Fat32Dir *)calloc(1, sizeof(Fat32Dir));
+  d->volume = v;
+  d->cluster = cluster;
+  d->entries = (struct Fat32DirEntry *)malloc(sizeof(struct Fat32DirEntry) * entries);
+  d->longNames = (char **)calloc(entries, sizeof(char *));
+  if(fat32ExtentRead(v, &map, d->entries, 0, bytes) != bytes)
+  {
+    free(map.extents);
+    fat32CloseDir(d);
+    return NULL;
+  }
+  free(map.extents);
+  while(d->count < entries && d->entries[d->count].DIR_Name[0] != 0x00)
+    d->count++;
+
+  uint16_t chars[MAX_LONG_PARTS * 13];
+  int expected = 0;
+  uint8_t checksum = 0;
+  for(int i = 0; i < d->count; i++)
+  {
+    uint8_t *raw = (uint8_t *)&d->entries[i];
+    if(raw[0] == 0xE5)
+    {
+      expected = 0;
+    }
+    else if((raw[11] & 0x3F) == 0x0F)
+    {
+      int ordinal = raw[0] & 0x1F;
+      if(raw[0] & 0x40)
+      {
+        memset(chars, 0, sizeof(chars));
+        expected = ordinal;
+        checksum = raw[13];
+      }
+      if(ordinal < 1 || ordinal > MAX_LONG_PARTS || ordinal != expected || raw[13] != checksum)
+      {
+        expected = 0;
+        continue;
+      }
+      uint16_t *part = &chars[(ordinal - 1) * 13];
+      memcpy(part, raw + 1, 10);
+      memcpy(part + 5, raw + 14, 12);
+      memcpy(part + 11, raw + 28, 4);
+      expected = ordinal - 1 == 0 ? -1 : ordinal - 1;
+    }
+    else
+    {
+      if(expected == -1 && fat32ShortNameChecksum(d->entries[i].DIR_Name) == checksum)
+        d->longNames[i] = fat32Ucs2ToUtf8(chars, MAX_LONG_PARTS * 13);
+      expected = 0;
+    }
+  }
+  return d;
+}
+
+/*
+ * parameters  : An open directory and the entry to fill in
+ * returns     : 1 if an entry was filled in, 0 at the end of the directory
+ * description : Hands out the files and directories in on disk order. Deleted entries, long
+ *              name pieces and the volume label are skipped, "." and ".." are not.
+ */
+int fat32ReadDir(Fat32Dir *d, struct Fat32Entry *entry)
+{
+  while(d->next < d->count)
+  {
+    int i = d->next++;
+    struct Fat32DirEntry *e = &d->entries[i];
+    if((uint8_t)e->DIR_Name[0] == 0xE5 || (e->DIR_Attr & 0x3F) == 0x0F || (e->DIR_Attr & 0x08))
+      continue;
+    fillEntry(d, i, entry);
+    return 1;
+  }
+  return 0;
+}
+
+// fills entry in from the 8.3 entry at index and its long name
+static void fillEntry(Fat32Dir *d, int index, struct Fat32Entry *entry)
+{
+  struct Fat32DirEntry *e = &d->entries[index];
+  fat32ShortName(e->DIR_Name, entry->shortName);
+  snprintf(entry->name, sizeof(entry->name), "%s",
+           d->longNames[index] != NULL ? d->longNames[index] : entry->shortName);
+  entry->attr = e->DIR_Attr;
+  entry->cluster = fat32EntryCluster(e);
+  entry->size = e->DIR_Attr & 0x10 ? 0 : e->DIR_FileSize;
+  entry->index = index;
+}
+
+void fat32RewindDir(Fat32Dir *d)
+{
+  d->next = 0;
+}
+
+void fat32CloseDir(Fat32Dir *d)
+{
+  if(d == NULL)
+    return;
+  for(int i = 0; d->longNames != NULL && i < d->count; i++)
+    free(d->longNames[i]);
+  free(d->entries);
+  free(d->longNames);
+  free(d);
+}
+
+uint32_t fat32DirCluster(const Fat32Dir *d)
+{
+  return d->cluster;
+}
+
+// the raw entries and long names below stay owned by the directory and are valid until it is
+// closed. both arrays have fat32DirCount() elements
+int fat32DirCount(const Fat32Dir *d)
+{
+  return d->count;
+}
+
+struct Fat32DirEntry *fat32DirEntries(Fat32Dir *d)
+{
+  return d->entries;
+}
+
+char **fat32DirLongNames(Fat32Dir *d)
+{
+  return d->longNames;
+}
+
+/*
+ * parameters  : The volume, an absolute path with components separated by '/' and the entry
+ *              to fill in
+ * returns     : 0 if the path exists, -1 otherwise
+ * description : Walks the path from the root directory. Components match a long name or an
+ *              8.3 name without regard to ASCII case. An empty path or "/" gives the root.
+ */
+int fat32Lookup(Fat32Volume *v, const char *path, struct Fat32Entry *entry)
+{
+  memset(entry, 0, sizeof(struct Fat32Entry));
+  strcpy(entry->name, "/");
+  strcpy(entry->shortName, "/");
+  entry->attr = 0x10;
+  entry->cluster = v->info.BPB_RootClus;
+  entry->index = -1;
+
+  char *copy = strdup(path);
+  char *rest = copy;
+  char *component;
+  int ret = 0;
+  while(ret == 0 && (component = strsep(&rest, "/")) != NULL)
+  {
+    if(component[0] == '\0')
+      continue;
+    if(!(entry->attr & 0x10))
+    {
+      ret = -1;
+      break;
+    }
+    Fat32Dir *d = fat32OpenDir(v, entry->cluster);
+    if(d == NULL)
+    {
+      ret = -1;
+      break;
+    }
+    char normalized[11];
+    int isShort = fat32NormalizeName(component, normalized) == 0;
+    int found = -1;
+    for(int i = 0; i < d->count && found == -1; i++)
+    {
+      struct Fat32DirEntry *e = &d->entries[i];
+      if((uint8_t)e->DIR_Name[0] == 0xE5 || (e->DIR_Attr & 0x3F) == 0x0F || (e->DIR_Attr & 0x08))
+        continue;
+      if((isShort && memcmp(e->DIR_Name, normalized, 11) == 0) ||
+         (d->longNames[i] != NULL && strcasecmp(d->longNames[i], component) == 0))
+        found = i;
+    }
+    if(found == -1)
+      ret = -1;
+    else
+    {
+      fillEntry(d, found, entry);
+      if((entry->attr & 0x10) && entry->cluster == 0)
+        entry->cluster = v->info.BPB_RootClus;
+    }
+    fat32CloseDir(d);
+  }
+  free(copy);
+  return ret;
+}
+
+// opens a file found with fat32ReadDir() or fat32Lookup() for reading, NULL for a directory
+Fat32File *fat32OpenFile(Fat32Volume *v, const struct Fat32Entry *entry)
+{
+  if(entry->attr & 0x10)
+    return NULL;
+  Fat32File *f = (Fat32File *)malloc(sizeof(Fat32File));
+  f->volume = v;
+  f->size = entry->size;
+  fat32BuildExtents(v, entry->cluster, &f->map);
+  return f;
+}
+
+// reads up to len bytes at offset in the file, returns how many were read, 0 at the end of
+// the file and -1 if the image could not be read. like pread() there is no file position
+ssize_t fat32Pread(Fat32File *f, void *buf, size_t len, uint64_t offset)
+{
+  if(offset >= f->size)
+    return 0;
+  if(len > f->size - offset)
+    len = f->size - offset;
+  int64_t done = fat32ExtentRead(f->volume, &f->map, buf, offset, len);
+  return done == 0 && len > 0 ? -1 : done;
+}
+
+uint32_t fat32FileSize(const Fat32File *f)
+{
+  return f->size;
+}
+
+void fat32CloseFile(Fat32File *f)
+{
+  if(f == NULL)
+    return;
+  free(f->map.extents);
+  free(f);
+}
+
+// returns 1 for the files and directories of a directory, whatever their read only, hidden,
+// system and archive bits. deleted and unused entries, long name pieces and the volume label
+// are not files
+int fat32IsVisible(const struct Fat32DirEntry *entry)
+{
+  uint8_t first = (uint8_t)entry->DIR_Name[0];
+  if(first == 0xE5 || first == 0x00)
+    return 0;
+  return (entry->DIR_Attr & 0x3F) != 0x0F && !(entry->DIR_Attr & 0x08);
+}
+
+// the first cluster of an entry, put together from both of its halves
+uint32_t fat32EntryCluster(const struct Fat32DirEntry *entry)
+{
+  return ((uint32_t)entry->DIR_FirstClusterHigh << 16) | entry->DIR_FirstClusterLow;
+}
+
+/*
+ * parameters  : A file name as the user types it and an 11 byte buffer
+ * returns     : 0 on success, -1 if the name can not be an 8.3 name
+ * description : Turns a name like "foo.txt" into the on disk form "FOO     TXT" so it can be
+ *              compared against DIR_Name directly. "." and ".." are kept as they are.
+ */
+int fat32NormalizeName(const char *str, char *normalized)
+{
+  size_t len = strlen(str);
+  if(len > 12 || len < 1)
+    return -1;
+  memset(normalized, ' ', 11);
+  if(strcmp(str, ".") == 0 || strcmp(str, "..") == 0)
+  {
+    memcpy(normalized, str, len);
+    return 0;
+  }
+  const char *dot = strchr(str, '.');
+  size_t base = dot == NULL ? len : (size_t)(dot - str);
+  size_t ext = dot == NULL ? 0 : len - base - 1;
+  if(base > 8 || ext > 3 || (dot != NULL && strchr(dot + 1, '.') != NULL))
+    return -1;
+  for(size_t i = 0; i < base; i++)
+    normalized[i] = toupper(str[i]);
+  for(size_t i = 0; i < ext; i++)
+    normalized[8 + i] = toupper(dot[1 + i]);
+  return 0;
+}
+
+// formats an 11 byte on disk name as NAME.EXT into buffer, which has to hold 13 bytes
+const char *fat32ShortName(const char *raw, char *buffer)
+{
+  int len = 0;
+  for(int i = 0; i < 8 && raw[i] != ' '; i++)
+    buffer[len++] = raw[i];
+  if(raw[8] != ' ')
+  {
+    buffer[len++] = '.';
+    for(int i = 8; i < 11 && raw[i] != ' '; i++)
+      buffer[len++] = raw[i];
+  }
+  buffer[len] = '\0';
+  return buffer;
+}
+
+// the checksum of an 8.3 name that every long name entry belonging to it carries
+uint8_t fat32ShortNameChecksum(const char *name)
+{
+  uint8_t sum = 0;
+  for(int i = 0; i < 11; i++)
+    sum = ((sum & 1) << 7) + (sum >> 1) + (uint8_t)name[i];
+  return sum;
+}
+
+/*
+ * parameters  : UCS-2 characters taken from long name entries and how many there are
+ * returns     : A malloc'd UTF-8 string, ending at the first 0x0000 or 0xFFFF padding character
+ * description : Surrogate pairs are combined into a single code point before encoding.
+ */
+char *fat32Ucs2ToUtf8(const uint16_t *chars, int count)
+{
+  char *out = (char *)malloc(count * 3 + 1);
+  char *p = out;
+  for(int i = 0; i < count && chars[i] != 0x0000 && chars[i] != 0xFFFF; i++)
+  {
+    uint32_t c = chars[i];
+    if(c >= 0xD800 && c < 0xDC00 && i + 1 < count && chars[i + 1] >= 0xDC00 && chars[i + 1] < 0xE000)
+    {
+      c = 0x10000 + ((c - 0xD800) << 10) + (chars[i + 1] - 0xDC00);
+      i++;
+    }
+    if(c < 0x80)
+    {
+      *p++ = c;
+    }
+    else if(c < 0x800)
+    {
+      *p++ = 0xC0 | (c >> 6);
+      *p++ = 0x80 | (c & 0x3F);
+    }
+    else if(c < 0x10000)
+    {
+      *p++ = 0xE0 | (c >> 12);
+      *p++ = 0x80 | ((c >> 6) & 0x3F);
+      *p++ = 0x80 | (c & 0x3F);
+    }
+    else
+    {
+      *p++ = 0xF0 | (c >> 18);
+      *p++ = 0x80 | ((c >> 12) & 0x3F);
+      *p++ = 0x80 | ((c >> 6) & 0x3F);
+      *p++ = 0x80 | (c & 0x3F);
+    }
+  }
+  *p = '\0';
+  return out;
+}
+
+// the reverse of fat32Ucs2ToUtf8(), returns the number of UCS-2 characters or -1 if str is not
+// valid UTF-8 or needs more than max of them
+int fat32Utf8ToUcs2(const char *str, uint16_t *chars, int max)
+{
+  const uint8_t *s = (const uint8_t *)str;
+  int count = 0;
+  while(*s != '\0')
+  {
+    uint32_t c;
+    int extra;
+    if(*s < 0x80)
+      c = *s, extra = 0;
+    else if((*s & 0xE0) == 0xC0)
+      c = *s & 0x1F, extra = 1;
+    else if((*s & 0xF0) == 0xE0)
+      c = *s & 0x0F, extra = 2;
+    else if((*s & 0xF8) == 0xF0)
+      c = *s & 0x07, extra = 3;
+    else
+      return -1;
+    s++;
+    for(int i = 0; i < extra; i++, s++)
+    {
+      if((*s & 0xC0) != 0x80)
+        return -1;
+      c = (c << 6) | (*s & 0x3F);
+    }
+    if(c >= 0x10000)
+    {
+      if(count + 2 > max)
+        return -1;
+      c -= 0x10000;
+      chars[count++] = 0xD800 + (c >> 10);
+      chars[count++] = 0xDC00 + (c & 0x3FF);
+    }
+    else
+    {
+      if(count + 1 > max)
+        return -1;
+      chars[count++] = c;
+    }
+  }
+  return count;
+}
@@ -0,0 +1,201 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Trevor Bakker
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+/*
+ * libfat32 reads (and in a small way writes) FAT32 images. Everything about an open image
+ * lives in a Fat32Volume handle, there is no global state, so any number of images can be
+ * open at once. All reads are positioned reads on the image descriptor, nothing depends on a
+ * shared file offset. They go through a block cache of cluster sized frames with a memory
+ * budget, and the FAT is loaded lazily with pages published atomically. Reading through one
+ * volume from several threads is therefore safe. Directory and file handles are owned by one
+ * thread each. Changing the FAT (fat32SetEntry() and fat32Flush()) or the cache size must not
+ * run alongside anything else on the same volume.
+ */
+
+#ifndef FAT32_H
+#define FAT32_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// image offsets go well past 4 GB, 32 bit hosts need -D_FILE_OFFSET_BITS=64
+_Static_assert(sizeof(off_t) == 8, "libfat32 needs a 64 bit off_t");
+
+#define FAT32_ENTRY_MASK 0x0FFFFFFF  // FAT32 entries only use their low 28 bits
+#define FAT32_BAD_CLUSTER 0x0FFFFFF7 // Marks a cluster as bad, anything above it is end of chain
+#define FAT32_END_OF_CHAIN 0x0FFFFFFF // What gets written at the end of a new chain
+
+#define FAT32_FSINFO_UNKNOWN 0xFFFFFFFF // FSInfo value meaning the count was never computed
+
+#define FAT32_MAX_NAME 1024     // Room for the longest long name in UTF-8 and its terminator
+
+#define FAT32_DEFAULT_CACHE_SIZE (8 * 1024 * 1024) // Block cache budget of a newly opened volume
+
+typedef struct Fat32Volume Fat32Volume;
+typedef struct Fat32Dir Fat32Dir;
+typedef struct Fat32File Fat32File;
+
+// A 32 byte directory entry as it is stored on disk
+struct __attribute__((__packed__)) Fat32DirEntry
+{
+  char DIR_Name[11];
+  uint8_t DIR_Attr;
+  uint8_t Unused1[8];
+  uint16_t DIR_FirstClusterHigh;
+  uint8_t Unused2[4];
+  uint16_t DIR_FirstClusterLow;
+  uint32_t DIR_FileSize;
+};
+
+// The boot sector fields of an open volume and what follows from them
+struct Fat32Info
+{
+  uint16_t BPB_BytsPerSec;
+  uint8_t BPB_SecPerClus;
+  uint16_t BPB_RsvdSecCnt;
+  uint8_t BPB_NumFATs;
+  uint32_t BPB_FATSz32;
+  uint32_t BPB_RootClus;
+  uint32_t BPB_TotSec32;
+  uint16_t BPB_FSInfo;
+  uint32_t clusterSize;         // bytes per cluster
+  uint32_t clusterCount;        // number of data clusters, numbered 2 to clusterCount + 1
+  uint32_t fatEntries;          // number of entries in one FAT
+  off_t fatStart;               // byte offset of the first FAT
+  off_t fatSize;                // bytes in one FAT copy
+  off_t dataStart;              // byte offset of cluster 2
+};
+
+// A run of clusters that are next to each other on disk
+struct Fat32Extent
+{
+  uint32_t fileCluster;         // index of the first cluster of the run inside the file
+  uint32_t diskCluster;         // cluster number of the first cluster of the run on disk
+  uint32_t count;               // number of clusters in the run
+};
+
+// The cluster chain of one file compressed into extents, sorted by fileCluster
+struct Fat32ExtentMap
+{
+  uint32_t firstCluster;        // first cluster of the chain, 0 for an empty chain
+  uint32_t clusters;            // length of the whole chain in clusters
+  int count;                    // number of extents
+  struct Fat32Extent *extents;  // malloc'd, freed by the owner of the map
+};
+
+// Counters of the block cache fat32Read() goes through
+struct Fat32CacheStats
+{
+  uint64_t hits;                // blocks found in the cache
+  uint64_t misses;              // blocks that had to be read from the image
+  uint64_t evictions;           // blocks pushed out to make room
+  uint32_t frames;              // frames the memory budget allows
+  uint32_t used;                // frames holding a block
+  uint32_t frameSize;           // bytes per frame, the cluster size
+};
+
+// I/O done on a volume since it was opened
+struct Fat32IoStats
+{
+  uint64_t reads;               // read calls on the image
+  uint64_t bytesRead;
+  uint64_t seeks;               // reads that did not start where the previous one ended
+  uint64_t writes;              // write calls on the image
+  uint64_t bytesWritten;
+  uint64_t fatLookups;          // FAT entries looked up, one per cluster a chain walk passes
+};
+
+// One entry handed out by fat32ReadDir() or fat32Lookup()
+struct Fat32Entry
+{
+  char name[FAT32_MAX_NAME];    // the long name in UTF-8, or the 8.3 name as NAME.EXT
+  char shortName[13];           // the 8.3 name as NAME.EXT
+  uint8_t attr;
+  uint32_t cluster;             // first cluster, 0 for an empty file
+  uint32_t size;                // size in bytes, 0 for directories
+  int index;                    // position of the 8.3 entry inside its directory
+};
+
+// volumes
+Fat32Volume *fat32Open(const char *path, int writable);
+void fat32Close(Fat32Volume *v);
+const struct Fat32Info *fat32GetInfo(const Fat32Volume *v);
+int fat32Descriptor(const Fat32Volume *v);
+int fat32Writable(const Fat32Volume *v);
+off_t fat32ImageSize(const Fat32Volume *v);
+int fat32Read(Fat32Volume *v, void *dst, off_t offset, size_t len);
+int fat32ReadDirect(Fat32Volume *v, void *dst, off_t offset, size_t len);
+int fat32Write(Fat32Volume *v, const void *src, off_t offset, size_t len);
+off_t fat32ClusterOffset(const Fat32Volume *v, uint32_t cluster);
+void fat32GetIoStats(Fat32Volume *v, struct Fat32IoStats *stats);
+void fat32CountRead(Fat32Volume *v, off_t offset, size_t len);
+void fat32CountWrite(Fat32Volume *v, size_t len);
+
+// the block cache
+int fat32SetCacheSize(Fat32Volume *v, size_t bytes);
+void fat32GetCacheStats(Fat32Volume *v, struct Fat32CacheStats *stats);
+void fat32ResetCacheStats(Fat32Volume *v);
+void fat32Invalidate(Fat32Volume *v, off_t offset, size_t len);
+
+// the FAT
+uint32_t fat32Entry(Fat32Volume *v, uint32_t cluster);
+uint32_t fat32Next(Fat32Volume *v, uint32_t cluster);
+void fat32SetEntry(Fat32Volume *v, uint32_t cluster, uint32_t value);
+int fat32Flush(Fat32Volume *v);
+int fat32ReadFSInfo(Fat32Volume *v, uint32_t *freeCount, uint32_t *nextFree);
+int fat32WriteFSInfo(Fat32Volume *v, uint32_t freeCount, uint32_t nextFree);
+
+// cluster chains
+void fat32BuildExtents(Fat32Volume *v, uint32_t firstCluster, struct Fat32ExtentMap *map);
+int fat32FindExtent(const struct Fat32ExtentMap *map, uint32_t fileCluster);
+int64_t fat32ExtentRead(Fat32Volume *v, const struct Fat32ExtentMap *map, void *dst, int64_t pos,
+                        int64_t len);
+int64_t fat32ExtentWrite(Fat32Volume *v, const struct Fat32ExtentMap *map, const void *src,
+                         int64_t pos, int64_t len);
+
+// directories
+Fat32Dir *fat32OpenDir(Fat32Volume *v, uint32_t cluster);
+int fat32ReadDir(Fat32Dir *d, struct Fat32Entry *entry);
+void fat32RewindDir(Fat32Dir *d);
+void fat32CloseDir(Fat32Dir *d);
+uint32_t fat32DirCluster(const Fat32Dir *d);
+int fat32DirCount(const Fat32Dir *d);
+struct Fat32DirEntry *fat32DirEntries(Fat32Dir *d);
+char **fat32DirLongNames(Fat32Dir *d);
+int fat32Lookup(Fat32Volume *v, const char *path, struct Fat32Entry *entry);
+
+// files
+Fat32File *fat32OpenFile(Fat32Volume *v, const struct Fat32Entry *entry);
+ssize_t fat32Pread(Fat32File *f, void *buf, size_t len, uint64_t offset);
+uint32_t fat32FileSize(const Fat32File *f);
+void fat32CloseFile(Fat32File *f);
+
+// names
+int fat32IsVisible(const struct Fat32DirEntry *entry);
+uint32_t fat32EntryCluster(const struct Fat32DirEntry *entry);
+int fat32NormalizeName(const char *str, char *normalized);
+const char *fat32ShortName(const char *raw, char *buffer);
+uint8_t fat32ShortNameChecksum(const char *name);
+char *fat32Ucs2ToUtf8(const uint16_t *chars, int count);
+int fat32Utf8ToUcs2(const char *str, uint16_t *chars, int max);
+
+#endif
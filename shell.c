@@ -35,6 +35,8 @@
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <spawn.h>
 
 #define WHITESPACE " \t\n"      // We want to split our command line up into tokens
                                 // so we need to define what delimits our tokens.
@@ -49,6 +51,16 @@
 
 #define MAX_PID_ITEMS_KEPT 15   // Max number of pids that will kept in history
 
+#define MAX_PIPELINE_STAGES 8   // Max number of commands that can be chained together with |
+
+#define MAX_TOKENS (MAX_NUM_ARGUMENTS * MAX_PIPELINE_STAGES) // Max tokens on one command line
+
+#define MAX_JOBS 16             // Max number of jobs that can be running or stopped at once
+
+#define JOB_RUNNING 0           // States of a job and of each of its commands
+#define JOB_STOPPED 1
+#define JOB_DONE 2
+
 //Structure used for the purpose of keeping track of the last 15 commands used
 //the commands will be kept in a linked list for ease of shifting up and down
 struct Node
@@ -64,9 +76,34 @@ struct pidNode
 {
   int pid;
   int number;
+  int state;            // JOB_RUNNING, JOB_STOPPED or JOB_DONE
   struct pidNode *next;
 };
 
+//Structure used to remember the commands of a pipeline and how each of them is doing
+struct Job
+{
+  int count;                            // number of commands in the pipeline, 0 for a free slot
+  int pids[MAX_PIPELINE_STAGES];
+  int status[MAX_PIPELINE_STAGES];      // wait status of each command
+  int state[MAX_PIPELINE_STAGES];       // JOB_RUNNING, JOB_STOPPED or JOB_DONE for each command
+  char *names[MAX_PIPELINE_STAGES];     // name of each command
+  char *line;                           // the command line as it was typed
+  int pgid;                             // process group all of the commands are in
+  int foreground;                       // the shell is waiting for the job
+  int order;                            // when the job was last started or stopped
+};
+
+//Structure used to keep track of every job that has not finished yet
+struct JobTable
+{
+  struct Job jobs[MAX_JOBS];            // job number n lives in slot n - 1
+  struct Job last;                      // the last foreground job that finished, for status
+  int order;                            // bumped every time a job starts or stops, the job with
+                                        // the highest order is the current one
+  int interactive;                      // stdin is a terminal the jobs have to take turns on
+};
+
 //function prototypes
 void deleteNode(struct Node *head);
 void trimNodes(struct Node *head);
@@ -79,6 +116,31 @@ void printPids(struct pidNode *head);
 void addPidLast(struct pidNode *head, struct pidNode *current, int add);
 void deletePid(struct pidNode *head);
 void trimPids(struct pidNode *head);
+struct pidNode *recordPid(struct pidNode *head, int pid);
+void setPidState(struct pidNode *head, int pid, int state);
+const char *stateName(int state);
+char *spaceOperators(const char *str);
+int splitPipeline(char **token, int token_count, char *stages[][MAX_NUM_ARGUMENTS],
+                  int *background);
+struct pidNode *runPipeline(char *stages[][MAX_NUM_ARGUMENTS], int count, int pipeSize,
+                            int background, const char *line, struct pidNode *pidHead,
+                            struct JobTable *table);
+void waitForeground(struct JobTable *table, struct pidNode *pidHead, int slot);
+void continueJob(struct JobTable *table, struct pidNode *pidHead, int slot, int foreground);
+void reapChildren(struct JobTable *table, struct pidNode *pidHead);
+void notifyJobs(struct JobTable *table);
+int jobState(struct Job *job);
+int findJob(struct JobTable *table, const char *arg);
+void finishJob(struct JobTable *table, int slot);
+void printJobs(struct JobTable *table);
+void clearJob(struct Job *job);
+void printStatus(struct Job *job);
+int spawnCommand(char **argv, int input, int output, int pgid, int foreground,
+                 int interactive);
+void onChild(int sig);
+
+// set by the SIGCHLD handler, tells the shell some child exited, stopped or continued
+volatile sig_atomic_t childChanged = 0;
 
 int main()
 {
@@ -86,8 +148,37 @@ int main()
   int control = 1;                                   // variable used as a the control variable for the main loop
   struct Node *head = NULL;                          // pointer to the history linked list
   struct pidNode *pidHead = NULL;                    // pointer to the pids linked list
+  struct JobTable table;                             // the jobs that have not finished yet
+  memset(&table, 0, sizeof(table));
+  // MSH_PIPE_SIZE asks for pipes with a bigger buffer than the kernel's default
+  int pipeSize = getenv("MSH_PIPE_SIZE") != NULL ? atoi(getenv("MSH_PIPE_SIZE")) : 0;
+  
+  // children are reaped from the main loop, the handler only notes that there is work to do.
+  // SA_RESTART keeps fgets from failing when a background job ends while the prompt waits
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onChild;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGCHLD, &action, NULL);
+  
+  // on a terminal the jobs take turns being its foreground process group. the shell must not
+  // be stopped when it takes the terminal back or when ctrl-z is typed at the prompt
+  table.interactive = isatty(STDIN_FILENO);
+  if(table.interactive)
+  {
+    signal(SIGTTOU, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+  }
+  
   while(control)
   {
+    // report the background jobs that finished since the last prompt
+    if(childChanged)
+      reapChildren(&table, pidHead);
+    notifyJobs(&table);
+    
     // clear the current buffer by setting it all to '\0'
     memset(cmd_str, '\0', MAX_COMMAND_SIZE);
     // Print out the msh prompt
@@ -140,7 +231,7 @@ int main()
     
     
     /* Parse input */
-    char *token[MAX_NUM_ARGUMENTS];
+    char *token[MAX_TOKENS];
     
     int token_count = 0;
     
@@ -148,7 +239,9 @@ int main()
     // parsed by strsep
     char *argument_ptr;
     
-    char *working_str = strdup( cmd_str );
+    // a | or & does not need spaces around it, so it gets them here to come out as a token of
+    // its own
+    char *working_str = spaceOperators( cmd_str );
     
     // we are going to move the working_str pointer so
     // keep track of its original value so we can deallocate
@@ -156,7 +249,7 @@ int main()
     char *working_root = working_str;
     
     // Tokenize the input strings with whitespace used as the delimiter
-    while ((token_count < MAX_NUM_ARGUMENTS) &&
+    while ((token_count < MAX_TOKENS) &&
            ((argument_ptr = strsep(&working_str, WHITESPACE )) != NULL))
     {
       token[token_count] = strndup( argument_ptr, MAX_COMMAND_SIZE );
@@ -168,9 +261,13 @@ int main()
       token_count++;
     }
     
+    // a line with more tokens than fit is refused rather than run cut short
+    int too_many = working_str != NULL && working_str[strspn(working_str, WHITESPACE)] != '\0';
+    if(too_many)
+      printf("Too many arguments.\n");
     
     //if there are any tokenized inputs proceed
-    if(token_count)
+    if(token_count && !too_many)
     {
       // if the input is quit or stop exit out of the loop after deallocating the dynamic memory
       if((strcmp(token[0], "quit") == 0 || strcmp(token[0], "stop") == 0) && token[1] == NULL)
@@ -187,6 +284,20 @@ int main()
         if(chdir(token[1]) != 0)
           printf("No such directory.\n");
       }
+      else if(strcmp(token[0], "status") == 0 && token[1] == NULL)
+      {
+        printStatus(&table.last);
+      }
+      else if(strcmp(token[0], "jobs") == 0 && token[1] == NULL)
+      {
+        printJobs(&table);
+      }
+      else if(strcmp(token[0], "fg") == 0 || strcmp(token[0], "bg") == 0)
+      {
+        int slot = findJob(&table, token[1]);
+        if(slot != -1)
+          continueJob(&table, pidHead, slot, token[0][0] == 'f');
+      }
       else if(strcmp(token[0], "listpids") == 0 && token[1] == NULL)
       {
         if(pidHead == NULL)
@@ -200,31 +311,13 @@ int main()
       }
       else
       {
-        int pid = fork();
-        if(pid == 0)
-        {
-          int ret = execvp(token[0], &token[0]);
-          if(ret == -1)
-            printf("%s: Command not found.\n", token[0]);
-          control = 0;
-        }
-        else
-        {
-          int status;
-          wait(&status);
-          if(pidHead == NULL)
-          {
-            pidHead = (struct pidNode *)malloc(sizeof(struct pidNode));
-            pidHead->pid = pid;
-            pidHead->next = NULL;
-            pidHead->number = 0;
-          }
-          else
-          {
-            addPidLast(pidHead, pidHead, pid);
-          }
-          
-        }
+        // a single command is just a pipeline with one stage
+        char *stages[MAX_PIPELINE_STAGES][MAX_NUM_ARGUMENTS];
+        int background;
+        int stage_count = splitPipeline(token, token_count, stages, &background);
+        if(stage_count > 0)
+          pidHead = runPipeline(stages, stage_count, pipeSize, background, cmd_str, pidHead,
+                                &table);
       }
     }
     
@@ -237,15 +330,486 @@ int main()
     }
     
     free(working_root);
-    free(argument_ptr);
     
   }
+  // stopped jobs would otherwise stay stopped forever once the shell is gone
+  for(int i = 0; i < MAX_JOBS; i++)
+  {
+    if(table.jobs[i].count > 0 && jobState(&table.jobs[i]) == JOB_STOPPED)
+    {
+      kill(-table.jobs[i].pgid, SIGHUP);
+      kill(-table.jobs[i].pgid, SIGCONT);
+    }
+    clearJob(&table.jobs[i]);
+  }
+  clearJob(&table.last);
   deletePid(pidHead);
   deleteNode(head);
   free(cmd_str);
   return 0;
 }
 
+// returns a copy of the command line with spaces put around every | and &, so "ls|wc" tokenizes
+// the same way "ls | wc" does. the copy has to be freed by the caller
+char *spaceOperators(const char *str)
+{
+  char *res = (char *)malloc(strlen(str) * 3 + 1);
+  char *out = res;
+  for(; *str != '\0'; str++)
+  {
+    if(*str != '|' && *str != '&')
+    {
+      *out++ = *str;
+      continue;
+    }
+    // the line never starts with white space, no need to add any in front of a leading operator
+    if(out != res)
+      *out++ = ' ';
+    *out++ = *str;
+    *out++ = ' ';
+  }
+  *out = '\0';
+  return res;
+}
+
+// splits the tokens into the commands of a pipeline, one per stages row, each ending in NULL
+// so it can go straight to execvp. empty tokens are skipped. a & at the very end sets background
+// and is dropped. returns the number of commands, or -1 after printing what is wrong with the line
+int splitPipeline(char **token, int token_count, char *stages[][MAX_NUM_ARGUMENTS],
+                  int *background)
+{
+  int count = 0;
+  int args = 0;
+  int end = token_count;
+  while(end > 0 && token[end - 1] == NULL)
+    end--;
+  *background = end > 0 && strcmp(token[end - 1], "&") == 0;
+  if(*background)
+    end--;
+  for(int i = 0; i <= end; i++)
+  {
+    // the end of the line closes the last command the same way a | does
+    if(i == end || (token[i] != NULL && strcmp(token[i], "|") == 0))
+    {
+      if(args == 0)
+      {
+        if(i < end || count > 0)
+          printf("Syntax error near |.\n");
+        else if(*background)
+          printf("Syntax error near &.\n");
+        return count == 0 && i == end && !*background ? 0 : -1;
+      }
+      stages[count][args] = NULL;
+      count++;
+      args = 0;
+      continue;
+    }
+    if(token[i] == NULL)
+      continue;
+    if(strcmp(token[i], "&") == 0)
+    {
+      printf("Syntax error near &.\n");
+      return -1;
+    }
+    if(count == MAX_PIPELINE_STAGES)
+    {
+      printf("Too many commands in the pipeline.\n");
+      return -1;
+    }
+    if(args == MAX_NUM_ARGUMENTS - 1)
+    {
+      printf("Too many arguments.\n");
+      return -1;
+    }
+    stages[count][args++] = token[i];
+  }
+  return count;
+}
+
+// this function receives the commands of a pipeline and starts them as a new job. all of them
+// are started up front, every one reading the pipe the one before it writes, so they all run at
+// the same time. the pipes are made with pipe2() and O_CLOEXEC so no command keeps a stray end
+// open, which would keep the next one from ever seeing end of file. with pipeSize set the pipes
+// get that much buffer through F_SETPIPE_SZ. the commands share a process group of their own so
+// the job can be stopped, continued and given the terminal as a whole. a foreground job is
+// waited for, a background one is left running and the prompt comes straight back. every pid is
+// added to the pid list, whose head is returned
+struct pidNode *runPipeline(char *stages[][MAX_NUM_ARGUMENTS], int count, int pipeSize,
+                            int background, const char *line, struct pidNode *pidHead,
+                            struct JobTable *table)
+{
+  int slot = 0;
+  while(slot < MAX_JOBS && table->jobs[slot].count > 0)
+    slot++;
+  if(slot == MAX_JOBS)
+  {
+    printf("Too many jobs.\n");
+    return pidHead;
+  }
+  struct Job *job = &table->jobs[slot];
+  int input = -1;               // read end of the pipe the next command takes its input from
+  for(int started = 0; started < count; started++)
+  {
+    int fds[2] = { -1, -1 };
+    if(started < count - 1)
+    {
+      if(pipe2(fds, O_CLOEXEC) == -1)
+      {
+        printf("Could not create a pipe.\n");
+        break;
+      }
+      if(pipeSize > 0)
+        fcntl(fds[1], F_SETPIPE_SZ, pipeSize);
+    }
+    int pid = spawnCommand(stages[started], input, fds[1], job->pgid, !background,
+                           table->interactive);
+    if(input != -1)
+      close(input);
+    if(fds[1] != -1)
+      close(fds[1]);
+    input = fds[0];
+    // a command that could not be started still has its place in the job, as one that
+    // ended at once with the status a shell gives a missing command
+    job->names[job->count] = strdup(stages[started][0]);
+    if(pid < 0)
+    {
+      printf("%s: Command not found.\n", stages[started][0]);
+      job->status[job->count] = 127 << 8;
+      job->state[job->count] = JOB_DONE;
+      job->count++;
+      continue;
+    }
+    if(job->pgid == 0)
+      job->pgid = pid;
+    job->pids[job->count] = pid;
+    job->state[job->count] = JOB_RUNNING;
+    job->count++;
+    pidHead = recordPid(pidHead, pid);
+  }
+  if(input != -1)
+    close(input);
+  if(job->count == 0)
+    return pidHead;
+  job->line = strndup(line, strcspn(line, "\n"));
+  job->order = ++table->order;
+  job->foreground = !background;
+  if(background && job->pgid != 0)
+    printf("[%d] %d\n", slot + 1, job->pgid);
+  if(!background)
+    waitForeground(table, pidHead, slot);
+  return pidHead;
+}
+
+/*
+ * parameters  : The command and its arguments, the descriptors its input and output come
+ *              from (-1 to keep the shell's), the process group to join (0 to start one),
+ *              whether it runs in the foreground and whether the shell is on a terminal
+ * returns     : The pid of the new process, or -1 if it could not be started
+ * description : Starts a command with posix_spawnp() rather than fork() and execvp(). glibc
+ *              runs the child on the shell's own memory until it has exec'd, so nothing of
+ *              the shell's address space is copied, and a command that can not be run is
+ *              reported here with no child left behind. Everything a forked child used to do
+ *              before exec is described up front: the pipe ends and /dev/null as file
+ *              actions, the process group, the default job control signals and an empty
+ *              signal mask as attributes, and with glibc 2.35 or later taking the terminal
+ *              for a foreground job. Older libraries leave that to waitForeground().
+ */
+int spawnCommand(char **argv, int input, int output, int pgid, int foreground,
+                 int interactive)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t signals;
+  pid_t pid;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawnattr_init(&attr);
+  // file actions run in order, the terminal has to be taken while stdin still is the terminal.
+  // the child takes it itself, before it can read from it in the wrong group
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+  if(foreground && interactive)
+    posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+#endif
+  if(input != -1)
+    posix_spawn_file_actions_adddup2(&actions, input, STDIN_FILENO);
+  // without a terminal to stop it a background job must not eat the shell's input
+  else if(!foreground && !interactive)
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  if(output != -1)
+    posix_spawn_file_actions_adddup2(&actions, output, STDOUT_FILENO);
+  posix_spawnattr_setpgroup(&attr, pgid);
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGTTOU);
+  sigaddset(&signals, SIGTTIN);
+  sigaddset(&signals, SIGTSTP);
+  posix_spawnattr_setsigdefault(&attr, &signals);
+  sigemptyset(&signals);
+  posix_spawnattr_setsigmask(&attr, &signals);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF |
+                           POSIX_SPAWN_SETSIGMASK);
+  // whatever the shell has buffered must reach the terminal before the command's own output
+  fflush(stdout);
+  int error = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  return error == 0 ? pid : -1;
+}
+
+// gives a job the terminal and waits until all of its commands have finished or it is stopped.
+// SIGCHLD is blocked between looking at the job and sigsuspend(), so a child that changes in
+// between still wakes the shell up
+void waitForeground(struct JobTable *table, struct pidNode *pidHead, int slot)
+{
+  struct Job *job = &table->jobs[slot];
+  sigset_t block, old, suspend;
+  sigemptyset(&block);
+  sigaddset(&block, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &block, &old);
+  suspend = old;
+  sigdelset(&suspend, SIGCHLD);
+  if(table->interactive && job->pgid != 0)
+    tcsetpgrp(STDIN_FILENO, job->pgid);
+  while(1)
+  {
+    reapChildren(table, pidHead);
+    if(jobState(job) != JOB_RUNNING)
+      break;
+    sigsuspend(&suspend);
+  }
+  if(table->interactive)
+    tcsetpgrp(STDIN_FILENO, getpgrp());
+  if(jobState(job) == JOB_DONE)
+  {
+    finishJob(table, slot);
+  }
+  else
+  {
+    job->foreground = 0;
+    job->order = ++table->order;
+    printf("\n[%d] Stopped %s\n", slot + 1, job->line);
+  }
+  sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+// sends a stopped job SIGCONT. fg also gives it the terminal and waits for it, bg leaves it
+// running behind the prompt
+void continueJob(struct JobTable *table, struct pidNode *pidHead, int slot, int foreground)
+{
+  struct Job *job = &table->jobs[slot];
+  if(!foreground && jobState(job) == JOB_RUNNING)
+  {
+    printf("Job %d is already running in the background.\n", slot + 1);
+    return;
+  }
+  if(foreground)
+    printf("%s\n", job->line);
+  else
+    printf("[%d] %s\n", slot + 1, job->line);
+  fflush(stdout);
+  for(int i = 0; i < job->count; i++)
+  {
+    if(job->state[i] == JOB_STOPPED)
+    {
+      job->state[i] = JOB_RUNNING;
+      setPidState(pidHead, job->pids[i], JOB_RUNNING);
+    }
+  }
+  job->order = ++table->order;
+  job->foreground = foreground;
+  if(foreground && table->interactive)
+    tcsetpgrp(STDIN_FILENO, job->pgid);
+  kill(-job->pgid, SIGCONT);
+  if(foreground)
+    waitForeground(table, pidHead, slot);
+}
+
+// collects every child that exited, stopped or continued since the last call without blocking,
+// and records the change in the job it belongs to and in the pid list
+void reapChildren(struct JobTable *table, struct pidNode *pidHead)
+{
+  int status;
+  int pid;
+  childChanged = 0;
+  while((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0)
+  {
+    int state = WIFSTOPPED(status) ? JOB_STOPPED : WIFCONTINUED(status) ? JOB_RUNNING : JOB_DONE;
+    setPidState(pidHead, pid, state);
+    for(int i = 0; i < MAX_JOBS; i++)
+    {
+      struct Job *job = &table->jobs[i];
+      for(int j = 0; j < job->count; j++)
+      {
+        if(job->pids[j] != pid)
+          continue;
+        job->state[j] = state;
+        if(state == JOB_DONE)
+          job->status[j] = status;
+      }
+    }
+  }
+}
+
+// prints and retires the background jobs that have finished. like the shell's own $? their
+// exit status is that of their last command
+void notifyJobs(struct JobTable *table)
+{
+  for(int i = 0; i < MAX_JOBS; i++)
+  {
+    struct Job *job = &table->jobs[i];
+    if(job->count == 0 || job->foreground || jobState(job) != JOB_DONE)
+      continue;
+    int status = job->status[job->count - 1];
+    if(WIFSIGNALED(status))
+      printf("[%d] Killed by signal %d %s\n", i + 1, WTERMSIG(status), job->line);
+    else if(WEXITSTATUS(status) != 0)
+      printf("[%d] Exit %d %s\n", i + 1, WEXITSTATUS(status), job->line);
+    else
+      printf("[%d] Done %s\n", i + 1, job->line);
+    clearJob(job);
+  }
+}
+
+// a job is done once all of its commands are, and stopped once none of them is still running
+int jobState(struct Job *job)
+{
+  int state = JOB_DONE;
+  for(int i = 0; i < job->count; i++)
+  {
+    if(job->state[i] == JOB_RUNNING)
+      return JOB_RUNNING;
+    if(job->state[i] == JOB_STOPPED)
+      state = JOB_STOPPED;
+  }
+  return state;
+}
+
+// finds the job fg or bg was given, as n or %n. without one it is the current job, the one that
+// was started or stopped last. returns its slot, or -1 after printing why there is none
+int findJob(struct JobTable *table, const char *arg)
+{
+  if(arg == NULL)
+  {
+    int current = -1;
+    for(int i = 0; i < MAX_JOBS; i++)
+    {
+      if(table->jobs[i].count > 0 &&
+         (current == -1 || table->jobs[i].order > table->jobs[current].order))
+        current = i;
+    }
+    if(current == -1)
+      printf("No current job.\n");
+    return current;
+  }
+  int number = atoi(arg[0] == '%' ? arg + 1 : arg);
+  if(number < 1 || number > MAX_JOBS || table->jobs[number - 1].count == 0)
+  {
+    printf("%s: No such job.\n", arg);
+    return -1;
+  }
+  return number - 1;
+}
+
+// moves a finished foreground job out of the table into last, where status finds it
+void finishJob(struct JobTable *table, int slot)
+{
+  clearJob(&table->last);
+  table->last = table->jobs[slot];
+  memset(&table->jobs[slot], 0, sizeof(struct Job));
+}
+
+// lists the jobs that have not finished yet, marking the current one with a +
+void printJobs(struct JobTable *table)
+{
+  int current = -1;
+  for(int i = 0; i < MAX_JOBS; i++)
+  {
+    if(table->jobs[i].count > 0 &&
+       (current == -1 || table->jobs[i].order > table->jobs[current].order))
+      current = i;
+  }
+  for(int i = 0; i < MAX_JOBS; i++)
+  {
+    struct Job *job = &table->jobs[i];
+    if(job->count > 0)
+      printf("[%d]%c %-8s %s\n", i + 1, i == current ? '+' : ' ', stateName(jobState(job)),
+             job->line);
+  }
+}
+
+// frees the names a job holds and empties it
+void clearJob(struct Job *job)
+{
+  for(int i = 0; i < job->count; i++)
+    free(job->names[i]);
+  free(job->line);
+  memset(job, 0, sizeof(struct Job));
+}
+
+// prints how every command of the last foreground job ended
+void printStatus(struct Job *job)
+{
+  if(job->count == 0)
+  {
+    printf("No commands have been run in this instance.\n");
+    return;
+  }
+  for(int i = 0; i < job->count; i++)
+  {
+    if(job->pids[i] == 0)
+      printf("%d: %s could not be started\n", i + 1, job->names[i]);
+    else if(WIFSIGNALED(job->status[i]))
+      printf("%d: %s (%d) killed by signal %d\n", i + 1, job->names[i], job->pids[i],
+             WTERMSIG(job->status[i]));
+    else
+      printf("%d: %s (%d) exited with %d\n", i + 1, job->names[i], job->pids[i],
+             WEXITSTATUS(job->status[i]));
+  }
+}
+
+// SIGCHLD handler. waitpid() and the job table are left to the main loop, all the handler does
+// is say that there is something to collect
+void onChild(int sig)
+{
+  childChanged = 1;
+}
+
+// adds a pid to the end of the pid list, starting the list if there is none yet. returns the
+// head of the list
+struct pidNode *recordPid(struct pidNode *head, int pid)
+{
+  if(head != NULL)
+  {
+    addPidLast(head, head, pid);
+    return head;
+  }
+  head = (struct pidNode *)malloc(sizeof(struct pidNode));
+  head->pid = pid;
+  head->state = JOB_RUNNING;
+  head->next = NULL;
+  head->number = 0;
+  return head;
+}
+
+// finds a pid in the pid list and records what happened to it
+void setPidState(struct pidNode *head, int pid, int state)
+{
+  for(; head != NULL; head = head->next)
+  {
+    // a finished pid may have been handed out again, only the live entry is the same process
+    if(head->pid == pid && head->state != JOB_DONE)
+      head->state = state;
+  }
+}
+
+// the word jobs and listpids print for a state
+const char *stateName(int state)
+{
+  if(state == JOB_RUNNING)
+    return "Running";
+  if(state == JOB_STOPPED)
+    return "Stopped";
+  return "Done";
+}
+
 // accepts a char pointer and will get rid of any leading white spoce by shifting the whole string
 // in place. no return type as everything is done on the same pointer.
 void sanitizeString(char * strPtr)
@@ -352,7 +916,7 @@ void printPids(struct pidNode *head)
   if(head == NULL)
     return;
   if(head->number > -1)
-    printf("%d: %d\n", head->number + 1, head->pid);
+    printf("%d: %d %s\n", head->number + 1, head->pid, stateName(head->state));
   printPids(head->next);
 }
 
@@ -369,6 +933,7 @@ void addPidLast(struct pidNode *head, struct pidNode *current, int add)
   {
     struct pidNode *res = (struct pidNode *)malloc(sizeof(struct pidNode));
     res->pid = add;
+    res->state = JOB_RUNNING;
     res->number = current->number + 1;
     res->next = NULL;
     current->next = res;